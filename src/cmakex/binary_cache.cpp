@@ -0,0 +1,364 @@
+#include "binary_cache.h"
+
+#include <algorithm>
+#include <tuple>
+
+#include <nowide/cstdlib.hpp>
+
+#include <Poco/File.h>
+#include <Poco/Process.h>
+
+#include <adasworks/sx/check.h>
+
+#include "cereal_utils.h"
+#include "cmakex_utils.h"
+#include "filesystem.h"
+#include "misc_utils.h"
+#include "print.h"
+
+namespace cmakex {
+struct binary_cache_entry_t
+{
+    string pkg_name;
+    string config;
+    string git_sha;
+    vector<string> files;  // relative to the install dir
+    vector<string> hijack_modules_needed;
+};
+}
+
+CEREAL_CLASS_VERSION(cmakex::binary_cache_entry_t, 1)
+
+namespace cmakex {
+
+namespace fs = filesystem;
+
+#define A(X) cereal::make_nvp(#X, m.X)
+
+template <class Archive>
+void serialize(Archive& archive, binary_cache_entry_t& m, uint32_t version)
+{
+    THROW_UNLESS(version == 1);
+    archive(A(pkg_name), A(config), A(git_sha), A(files), A(hijack_modules_needed));
+}
+
+#undef A
+
+static const char* const k_binary_cache_entry_filename = "entry.json";
+static const char* const k_binary_cache_files_dir = "files";
+
+namespace {
+// finds an executable on the PATH, returns empty if not found
+string find_on_path(string_par name)
+{
+#ifdef _WIN32
+    const char path_separator = ';';
+    const vector<string> extensions = {"", ".exe"};
+#else
+    const char path_separator = ':';
+    const vector<string> extensions = {""};
+#endif
+    auto path = nowide::getenv("PATH");
+    if (!path)
+        return {};
+    for (auto& dir : split(path, path_separator)) {
+        for (auto& ext : extensions) {
+            string candidate = (dir.empty() ? string(".") : dir) + "/" + name.str() + ext;
+            if (fs::is_regular_file(candidate))
+                return candidate;
+        }
+    }
+    return {};
+}
+
+// A compiler is identified by the size and time of its executable so an upgrade in place changes
+// the key and `c++`, `/usr/bin/c++` and the file it's linked to are the same compiler. A compiler
+// that can't be found is identified by the name.
+string compiler_identity(string_par compiler)
+{
+    if (compiler.empty())
+        return {};
+    auto words = separate_arguments(compiler);  // CC can be like "ccache gcc"
+    string exe = words.empty() ? compiler.str() : words.front();
+    string path = fs::path(exe).is_absolute() ? exe : find_on_path(exe);
+    if (!path.empty()) {
+        try {
+            Poco::File f(path);
+            if (f.isFile()) {
+                string r = stringf("%llu %lld", (unsigned long long)f.getSize(),
+                                   (long long)f.getLastModified().epochMicroseconds());
+                for (size_t i = 1; i < words.size(); ++i)
+                    r += " " + words[i];
+                return r;
+            }
+        } catch (...) {
+        }
+    }
+    return compiler.str();
+}
+
+// The generator and the compilers the config will be built with. An existing CMakeCache.txt of
+// the package keeps the ones it was created with, otherwise they come from the cmake args, the
+// environment or the defaults.
+vector<string> toolchain_lines(const installed_config_desc_t& desc, const cmakex_config_t& cfg)
+{
+    auto& args = desc.final_cmake_args.args;
+    cmake_cache_t cache;
+    auto cache_path = cfg.pkg_binary_dir_of_config(desc.pkg_name, desc.config,
+                                                   cfg.cmakex_cache().per_config_bin_dirs) +
+                      "/CMakeCache.txt";
+    if (fs::is_regular_file(cache_path))
+        cache = read_whole_cmake_cache(cache_path);
+    auto getenv_or_empty = [](const char* name) {
+        auto e = nowide::getenv(name);
+        return string(e ? e : "");
+    };
+
+    vector<string> lines;
+    string generator = extract_generator_from_cmake_args(args);
+    if (generator.empty())
+        generator = map_at_or_default(cache.vars, "CMAKE_GENERATOR");
+    if (generator.empty())
+        generator = getenv_or_empty("CMAKE_GENERATOR");
+#ifndef _WIN32
+    if (generator.empty())
+        generator = "Unix Makefiles";
+#endif
+    lines.emplace_back("generator=" + generator);
+    for (auto v : {"CMAKE_GENERATOR_PLATFORM", "CMAKE_GENERATOR_TOOLSET"}) {
+        string value = map_at_or_default(cache.vars, v);
+        lines.emplace_back(stringf("%s=%s", v, value.empty() ? getenv_or_empty(v).c_str()
+                                                             : value.c_str()));
+    }
+
+    const vector<std::tuple<const char*, const char*, const char*>> languages = {
+#ifdef _WIN32
+        std::make_tuple("CMAKE_C_COMPILER", "CC", "cl"),
+        std::make_tuple("CMAKE_CXX_COMPILER", "CXX", "cl")
+#else
+        std::make_tuple("CMAKE_C_COMPILER", "CC", "cc"),
+        std::make_tuple("CMAKE_CXX_COMPILER", "CXX", "c++")
+#endif
+    };
+    for (auto& l : languages) {
+        const char* var = std::get<0>(l);
+        string compiler;
+        if (auto a = find_specific_cmake_arg_or_null(var, args))
+            compiler = parse_cmake_arg(*a).value;
+        if (compiler.empty())
+            compiler = map_at_or_default(cache.vars, var);
+        if (compiler.empty())
+            compiler = getenv_or_empty(std::get<1>(l));
+        if (compiler.empty())
+            compiler = std::get<2>(l);
+        lines.emplace_back(stringf("%s=%s", var, compiler_identity(compiler).c_str()));
+    }
+    for (auto v : {"CFLAGS", "CXXFLAGS", "LDFLAGS"})
+        lines.emplace_back(stringf("%s=%s", v, getenv_or_empty(v).c_str()));
+    return lines;
+}
+
+string binary_cache_key_core(const installed_config_desc_t& desc,
+                             const InstallDB& installdb,
+                             const vector<string>& prefix_paths,
+                             const cmakex_config_t& cfg,
+                             const vector<string>& toolchain)
+{
+    if (desc.git_sha.empty() || starts_with(desc.git_sha, "<"))
+        return {};  // not a commit, see create_desc() in install_deps_phase_two
+    vector<string> lines = {"cmakex-binary-cache-2",
+                            desc.pkg_name,
+                            desc.config.get_prefer_NoConfig(),
+                            desc.git_sha,
+                            desc.source_dir,
+                            desc.final_cmake_args.c_sha,
+                            desc.final_cmake_args.cmake_toolchain_file_sha};
+    lines.insert(lines.end(), BEGINEND(toolchain));
+    // the paths into the build dir are left out, the other prefix and module paths are kept
+    const vector<string> build_dir_paths = {cfg.deps_install_dir(), cfg.find_module_hijack_dir()};
+    for (auto& a : desc.final_cmake_args.args) {
+        auto pca = parse_cmake_arg(a);
+        if (pca.switch_ == "-D" &&
+            is_one_of(pca.name, {"CMAKE_INSTALL_PREFIX", "CMAKE_TOOLCHAIN_FILE"}))
+            continue;
+        if (pca.switch_ == "-D" && is_one_of(pca.name, {"CMAKE_PREFIX_PATH", "CMAKE_MODULE_PATH"})) {
+            vector<string> paths;
+            for (auto& x : split(pca.value, ';')) {
+                if (!is_one_of(x, build_dir_paths))
+                    paths.emplace_back(x);
+            }
+            lines.emplace_back(stringf("-D%s=%s", pca.name.c_str(), join(paths, ";").c_str()));
+            continue;
+        }
+        lines.emplace_back(a);
+    }
+    // the deps_shas depend on the install prefix, too, use the fingerprints of the dependencies
+    for (auto& kv : desc.deps_shas) {
+        auto& dep = kv.first;
+        auto installed = installdb.try_get_installed_pkg_all_configs(dep, prefix_paths);
+        for (auto& kv2 : kv.second) {
+            auto it = installed.config_descs.find(kv2.first);
+            if (it == installed.config_descs.end() || installed.config_sha(kv2.first) != kv2.second)
+                return {};
+            auto dep_key =
+                binary_cache_key_core(it->second, installdb, prefix_paths, cfg, toolchain);
+            if (dep_key.empty())
+                return {};
+            lines.emplace_back(stringf("%s %s %s", dep.c_str(),
+                                       kv2.first.get_prefer_NoConfig().c_str(), dep_key.c_str()));
+        }
+    }
+    return string_sha(join(lines, "\n"));
+}
+
+// true if the file contains any of the strings
+bool file_contains_any(string_par path, const vector<string>& xs)
+{
+    size_t max_size = 0;
+    for (auto& x : xs)
+        max_size = std::max(max_size, x.size());
+    if (max_size == 0)
+        return false;
+    auto f = must_fopen(path, "rb");
+    const size_t c_chunk_size = 65536;
+    // the last max_size - 1 bytes of the previous chunk are kept to find the matches spanning
+    // chunks
+    string buf;
+    vector<char> chunk(c_chunk_size);
+    for (;;) {
+        auto r = fread(chunk.data(), 1, chunk.size(), f);
+        if (r == 0)
+            break;
+        buf.append(chunk.data(), r);
+        for (auto& x : xs) {
+            if (!x.empty() && buf.find(x) != string::npos)
+                return true;
+        }
+        if (buf.size() >= max_size)
+            buf.erase(0, buf.size() - (max_size - 1));
+    }
+    return false;
+}
+}
+
+string binary_cache_key(const installed_config_desc_t& desc,
+                        const InstallDB& installdb,
+                        const vector<string>& prefix_paths,
+                        const cmakex_config_t& cfg)
+{
+    // the dependencies are built in the same build dir with the same toolchain
+    return binary_cache_key_core(desc, installdb, prefix_paths, cfg, toolchain_lines(desc, cfg));
+}
+
+maybe<vector<string>> restore_from_binary_cache(string_par cache_dir,
+                                                string_par key,
+                                                string_par install_dir)
+{
+    string entry_dir = cache_dir.str() + "/" + key.str();
+    string entry_path = entry_dir + "/" + k_binary_cache_entry_filename;
+    if (!fs::is_regular_file(entry_path))
+        return {};
+    vector<string> copied;  // removed if the restore fails
+    try {
+        binary_cache_entry_t e;
+        load_json_input_archive(entry_path, e);
+        for (auto& f : e.files) {
+            string dst = install_dir.str() + "/" + f;
+            fs::create_directories(fs::path(dst).parent_path());
+            // overwrites the files left by an earlier build or a failed restore, even read-only
+            // ones
+            if (fs::exists(dst))
+                fs::remove(dst);
+            copied.emplace_back(dst);
+            fs::copy_file(entry_dir + "/" + k_binary_cache_files_dir + "/" + f, dst);
+        }
+        return just(move(e.hijack_modules_needed));
+    } catch (const exception& e) {
+        log_warn("Can't restore %s from the binary cache, reason: %s",
+                 path_for_log(entry_dir).c_str(), e.what());
+    }
+    for (auto& f : copied) {
+        try {
+            if (fs::exists(f))
+                fs::remove(f);
+        } catch (...) {
+        }
+    }
+    return {};
+}
+
+void store_in_binary_cache(string_par cache_dir,
+                           string_par key,
+                           const installed_config_desc_t& desc,
+                           string_par pkg_bin_dir_of_config,
+                           string_par install_dir)
+{
+    string entry_dir = cache_dir.str() + "/" + key.str();
+    if (fs::exists(entry_dir))
+        return;
+    string manifest_path = pkg_bin_dir_of_config.str() + "/install_manifest.txt";
+    if (!fs::is_regular_file(manifest_path)) {
+        log_verbose("Not caching %s, it has no install manifest.", desc.pkg_name.c_str());
+        return;
+    }
+    // the entry is assembled in a temporary dir and renamed in place so other cmakex processes
+    // never see a partial entry
+    string tmp_dir = stringf("%s.tmp-%ld", entry_dir.c_str(), (long)Poco::Process::id());
+    try {
+        binary_cache_entry_t e;
+        e.pkg_name = desc.pkg_name;
+        e.config = desc.config.get_prefer_NoConfig();
+        e.git_sha = desc.git_sha;
+        e.hijack_modules_needed = desc.hijack_modules_needed;
+        const string prefix = install_dir.str() + "/";
+        for (auto& f : must_read_file_as_lines(manifest_path)) {
+            if (f.empty())
+                continue;
+            if (!starts_with(f, prefix)) {
+                log_verbose("Not caching %s, it installed %s outside of %s.",
+                            desc.pkg_name.c_str(), path_for_log(f).c_str(),
+                            path_for_log(install_dir).c_str());
+                return;
+            }
+            e.files.emplace_back(make_string(butleft(f, prefix.size())));
+        }
+        // the entries are restored into other install dirs, the files referring to this one
+        // (config modules, .pc files, RPATHs) would point to the wrong place
+        vector<string> install_dir_strings = {install_dir.str()};
+#ifdef _WIN32
+        string native_install_dir = install_dir.str();
+        std::replace(BEGINEND(native_install_dir), '/', '\\');
+        if (native_install_dir != install_dir_strings.front())
+            install_dir_strings.emplace_back(native_install_dir);
+#endif
+        bool refers_to_install_dir = false;
+        for (auto& f : e.files) {
+            if (file_contains_any(prefix + f, install_dir_strings)) {
+                log_verbose("Not caching %s, %s contains the install prefix.",
+                            desc.pkg_name.c_str(), path_for_log(prefix + f).c_str());
+                refers_to_install_dir = true;
+                break;
+            }
+            string dst = tmp_dir + "/" + k_binary_cache_files_dir + "/" + f;
+            fs::create_directories(fs::path(dst).parent_path());
+            fs::copy_file(prefix + f, dst);
+        }
+        if (!refers_to_install_dir) {
+            save_json_output_archive(tmp_dir + "/" + k_binary_cache_entry_filename, e);
+            fs::rename(tmp_dir, entry_dir);
+            log_verbose("Saved %s - %s into the binary cache.", desc.pkg_name.c_str(),
+                        e.config.c_str());
+        }
+    } catch (const exception& e) {
+        if (!fs::exists(entry_dir))  // not stored by another process meanwhile
+            log_warn("Can't save %s into the binary cache, reason: %s",
+                     path_for_log(entry_dir).c_str(), e.what());
+    }
+    if (fs::exists(tmp_dir)) {
+        try {
+            fs::remove_all(tmp_dir);
+        } catch (...) {
+        }
+    }
+}
+}
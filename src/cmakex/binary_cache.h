@@ -0,0 +1,42 @@
+#ifndef BINARY_CACHE_29384723
+#define BINARY_CACHE_29384723
+
+#include "cmakex_utils.h"
+#include "installdb.h"
+
+namespace cmakex {
+
+// Machine-wide cache of built dependency configurations, shared between build directories. An
+// entry holds the files a package configuration installed into the deps install dir, keyed by a
+// fingerprint of installed_config_desc_t.
+
+// The fingerprint covers the package name, config, git SHA, source dir, the generator, the
+// compilers (identified by their executables), the CFLAGS/CXXFLAGS/LDFLAGS env vars, the cmake args
+// except the paths into the build dir (CMAKE_INSTALL_PREFIX, the install and hijack dirs in
+// CMAKE_PREFIX_PATH and CMAKE_MODULE_PATH, CMAKE_TOOLCHAIN_FILE, the toolchain file's SHA is
+// included) and the fingerprints of the installed dependencies. Returns empty if the config can't
+// be cached: it has been built from uncommitted changes or a dependency is not installed the way
+// desc.deps_shas says.
+string binary_cache_key(const installed_config_desc_t& desc,
+                        const InstallDB& installdb,
+                        const vector<string>& prefix_paths,
+                        const cmakex_config_t& cfg);
+
+// Copies the files of the entry into install_dir, overwriting the existing ones, and returns the
+// hijack modules the config needs. Returns nothing if there's no such entry or it can't be restored
+// (logs a warning, the files copied so far are removed).
+maybe<vector<string>> restore_from_binary_cache(string_par cache_dir,
+                                                string_par key,
+                                                string_par install_dir);
+
+// Creates the entry from the install_manifest.txt in pkg_bin_dir_of_config. Only the files
+// installed under install_dir can be cached and none of them may contain the path of install_dir
+// since the entry can be restored into other install dirs. Failure is not an error, only logged.
+void store_in_binary_cache(string_par cache_dir,
+                           string_par key,
+                           const installed_config_desc_t& desc,
+                           string_par pkg_bin_dir_of_config,
+                           string_par install_dir);
+}
+
+#endif
@@ -9,9 +9,11 @@
 #include "cmakex_utils.h"
 #include "filesystem.h"
 #include "installdb.h"
+#include "jobserver.h"
+#include "log_writer.h"
 #include "misc_utils.h"
-#include "out_err_messages.h"
 #include "print.h"
+#include "step_durations.h"
 
 namespace cmakex {
 
@@ -26,7 +28,8 @@ build_result_t build(string_par binary_dir,
                      bool force_config_step,
                      const cmakex_cache_t& cmakex_cache,
                      vector<string> build_args,
-                     const vector<string>& native_tool_args)
+                     const vector<string>& native_tool_args,
+                     bool capture_main_project_output)
 {
     test_cmake();
 
@@ -102,12 +105,20 @@ build_result_t build(string_par binary_dir,
             build_args.end());
     }
 
-    log_info("Writing logs to %s.",
-             path_for_log(stringf("%s/%s-%s-*%s", cfg.cmakex_log_dir().c_str(), pkg_name.c_str(),
-                                  config.get_prefer_NoConfig().c_str(), k_log_extension))
-                 .c_str());
+    // the output of the main project goes directly to the console unless its configurations are
+    // being built in parallel
+    const bool capture_output = !pkg_name.empty() || capture_main_project_output;
+    const string log_prefix = pkg_name.empty() ? k_main_project_log_prefix : pkg_name.str();
 
-    const auto pipe_mode = g_supress_deps_cmake_logs ? pipe_capture : pipe_echo_and_capture;
+    if (capture_output)
+        log_info("Writing logs to %s.",
+                 path_for_log(stringf("%s/%s-%s-*%s", cfg.cmakex_log_dir().c_str(),
+                                      log_prefix.c_str(), config.get_prefer_NoConfig().c_str(),
+                                      log_file_extension().c_str()))
+                     .c_str());
+
+    const auto pipe_mode = g_supress_deps_cmake_logs || pkg_name.empty() ? pipe_capture
+                                                                         : pipe_echo_and_capture;
     {  // scope only
         auto cct = load_cmake_cache_tracker(pkg_bin_dir_of_config);
         cct.add_pending(cmake_args);
@@ -127,30 +138,27 @@ build_result_t build(string_par binary_dir,
             auto cl_config = log_exec("cmake", cmake_args_to_apply);
 
             int r;
-            if (pkg_name.empty()) {
+            if (!capture_output) {
                 r = exec_process("cmake", cmake_args_to_apply);
             } else {
-                OutErrMessagesBuilder oeb(pipe_mode, pipe_mode);
+                string step = stringf("%s-%s-configure", log_prefix.c_str(),
+                                      config.get_prefer_NoConfig().c_str());
+                LogWriter log(cl_config, cfg.cmakex_log_dir(), step + k_log_extension, pipe_mode,
+                              pipe_mode);
                 try {
-                    r = exec_process("cmake", cmake_args_to_apply, oeb.stdout_callback(),
-                                     oeb.stderr_callback());
+                    r = exec_process("cmake", cmake_args_to_apply, log.stdout_callback(),
+                                     log.stderr_callback());
                 } catch (...) {
                     if (g_verbose)
                         log_error("Exception during executing 'cmake' config-step.");
-                    r = ECANCELED;
                     fflush(stdout);
-                    save_log_from_oem(
-                        cl_config, r != EXIT_SUCCESS, oeb.move_result(), cfg.cmakex_log_dir(),
-                        stringf("%s-%s-configure%s", pkg_name.c_str(),
-                                config.get_prefer_NoConfig().c_str(), k_log_extension));
+                    log.finish(true);
                     fflush(stdout);
                     throw;
                 }
-                auto oem = oeb.move_result();
-
-                save_log_from_oem(cl_config, r != EXIT_SUCCESS, oem, cfg.cmakex_log_dir(),
-                                  stringf("%s-%s-configure%s", pkg_name.c_str(),
-                                          config.get_prefer_NoConfig().c_str(), k_log_extension));
+                log.finish(r != EXIT_SUCCESS);
+                if (r == EXIT_SUCCESS)
+                    record_step_duration(cfg.cmakex_log_dir(), step, log.duration());
             }
             if (r != EXIT_SUCCESS) {
                 if (initial_build && fs::is_regular_file(cmake_cache_path))
@@ -168,7 +176,10 @@ build_result_t build(string_par binary_dir,
             // fixed so we can write out the cmakex cache if it's dirty
             // when processing dependencies the cmakex cache has already been written out after
             // configuring the helper project
-            write_cmakex_cache_if_dirty(binary_dir, cmakex_cache);
+            // the configurations of the main project being built in parallel would write it at the
+            // same time, run_cmake_steps writes it after them
+            if (!capture_main_project_output)
+                write_cmakex_cache_if_dirty(binary_dir, cmakex_cache);
         }
     }
 
@@ -210,34 +221,44 @@ build_result_t build(string_par binary_dir,
         string cl_build = log_exec("cmake", args);
         {  // scope only
             int r;
-            if (pkg_name.empty()) {
-                r = exec_process("cmake", args);
+            // the implicit job of the native build tool, MAKEFLAGS is passed only to the build
+            // steps
+            jobserver_token_t jobserver_token;
+            if (!capture_output) {
+                r = exec_process("cmake", args, "", nullptr, nullptr, jobserver_token.env());
             } else {
-                OutErrMessagesBuilder oeb(pipe_mode, pipe_mode);
+                string step = stringf("%s-%s-build-%s", log_prefix.c_str(),
+                                      config.get_prefer_NoConfig().c_str(),
+                                      target.empty() ? "all" : target.c_str());
+                LogWriter log(cl_build, cfg.cmakex_log_dir(), step + k_log_extension, pipe_mode,
+                              pipe_mode);
+                // the lines of the install step that may name a config-module, the log itself is
+                // not kept in memory
+                vector<string> config_module_lines;
+                if (target == "install" && !pkg_name.empty()) {
+                    log.set_line_callback([&config_module_lines](LogWriter::source_t,
+                                                                 array_view<const char> line) {
+                        auto text = trim(make_string(line));
+                        if (ends_with(text, "-config.cmake") || ends_with(text, "Config.cmake"))
+                            config_module_lines.emplace_back(move(text));
+                    });
+                }
                 try {
-                    r = exec_process("cmake", args, oeb.stdout_callback(), oeb.stderr_callback());
+                    r = exec_process("cmake", args, "", log.stdout_callback(),
+                                     log.stderr_callback(), jobserver_token.env());
                 } catch (...) {
                     if (g_verbose)
                         log_error("Exception during executing 'cmake' build-step.");
-                    r = ECANCELED;
                     fflush(stdout);
-                    save_log_from_oem(
-                        cl_build, r != EXIT_SUCCESS, oeb.move_result(), cfg.cmakex_log_dir(),
-                        stringf("%s-%s-build-%s%s", pkg_name.c_str(),
-                                config.get_prefer_NoConfig().c_str(),
-                                target.empty() ? "all" : target.c_str(), k_log_extension));
+                    log.finish(true);
                     fflush(stdout);
                     throw;
                 }
-                auto oem = oeb.move_result();
-
-                save_log_from_oem(
-                    cl_build, r != EXIT_SUCCESS, oem, cfg.cmakex_log_dir(),
-                    stringf("%s-%s-build-%s%s", pkg_name.c_str(),
-                            config.get_prefer_NoConfig().c_str(),
-                            target.empty() ? "all" : target.c_str(), k_log_extension));
+                log.finish(r != EXIT_SUCCESS);
+                if (r == EXIT_SUCCESS)
+                    record_step_duration(cfg.cmakex_log_dir(), step, log.duration());
 
-                if (r == EXIT_SUCCESS && target == "install") {
+                if (r == EXIT_SUCCESS && target == "install" && !pkg_name.empty()) {
                     vector<pair_ss> cmake_find_module_names;
                     bool cmake_find_module_names_loaded = false;
                     auto load_cmake_find_module_names = [&cmake_find_module_names, &cmakex_cache,
@@ -266,39 +287,35 @@ build_result_t build(string_par binary_dir,
 
                     // write out hijack module that tries the installed config module first
                     // collect the config-modules that has been written
-                    for (int i = 0; i < oem.size(); ++i) {
-                        auto v = split(oem.at(i).text, '\n');
-                        for (auto& text : v) {
-                            text = trim(text);
-                            auto colon_pos = text.find(':');
-                            if (colon_pos == string::npos)
-                                continue;
-                            auto path_str = trim(text.substr(colon_pos + 1));
-                            if (!ends_with(path_str, "-config.cmake") &&
-                                !ends_with(path_str, "Config.cmake"))
-                                continue;
-                            fs::path path(path_str);
-                            if (!fs::is_regular_file(path))
-                                continue;
-                            auto filename = path.filename().string();
-                            string base;
-                            for (auto e : {"-config.cmake", "Config.cmake"}) {
-                                if (ends_with(filename, e)) {
-                                    base = filename.substr(0, filename.size() - strlen(e));
-                                    break;
-                                }
+                    for (auto& text : config_module_lines) {
+                        auto colon_pos = text.find(':');
+                        if (colon_pos == string::npos)
+                            continue;
+                        auto path_str = trim(text.substr(colon_pos + 1));
+                        if (!ends_with(path_str, "-config.cmake") &&
+                            !ends_with(path_str, "Config.cmake"))
+                            continue;
+                        fs::path path(path_str);
+                        if (!fs::is_regular_file(path))
+                            continue;
+                        auto filename = path.filename().string();
+                        string base;
+                        for (auto e : {"-config.cmake", "Config.cmake"}) {
+                            if (ends_with(filename, e)) {
+                                base = filename.substr(0, filename.size() - strlen(e));
+                                break;
                             }
-                            if (base.empty())
-                                continue;
-                            // find out if there's such an official config module
-                            load_cmake_find_module_names();
-                            tolower_inplace(base);
-                            auto it = std::lower_bound(
-                                BEGINEND(cmake_find_module_names), tolower(base),
-                                [](const pair_ss& x, const string& y) { return x.first < y; });
-                            if (it->first == base)
-                                build_result.hijack_modules_needed.emplace_back(it->second);
                         }
+                        if (base.empty())
+                            continue;
+                        // find out if there's such an official config module
+                        load_cmake_find_module_names();
+                        tolower_inplace(base);
+                        auto it = std::lower_bound(
+                            BEGINEND(cmake_find_module_names), tolower(base),
+                            [](const pair_ss& x, const string& y) { return x.first < y; });
+                        if (it->first == base)
+                            build_result.hijack_modules_needed.emplace_back(it->second);
                     }
                 }
             }
@@ -25,7 +25,10 @@ build_result_t build(
                              // cache
     const cmakex_cache_t& cmakex_cache,
     vector<string> build_args,  // by value
-    const vector<string>& native_tool_args);
+    const vector<string>& native_tool_args,
+    bool capture_main_project_output = false);  // save main project's cmake output to log files
+                                                // instead of the console and don't write the
+                                                // cmakex cache (configs built in parallel)
 }
 
 #endif
@@ -0,0 +1,46 @@
+#include "build_slots.h"
+
+#include <exception>
+#include <thread>
+
+namespace cmakex {
+
+void build_slots_t::acquire()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait(lock, [this]() { return free_slots > 0; });
+    --free_slots;
+}
+
+void build_slots_t::release()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ++free_slots;
+    }
+    cv.notify_one();
+}
+
+void run_with_build_slots(int n, build_slots_t& slots, const std::function<void(int)>& f)
+{
+    vector<std::exception_ptr> errors(n);
+    vector<std::thread> threads;
+    threads.reserve(n);
+    for (int i = 0; i < n; ++i) {
+        threads.emplace_back([i, &slots, &f, &errors]() {
+            try {
+                build_slot_guard_t slot(slots);
+                f(i);
+            } catch (...) {
+                errors[i] = std::current_exception();
+            }
+        });
+    }
+    for (auto& t : threads)
+        t.join();
+    for (auto& e : errors) {
+        if (e)
+            std::rethrow_exception(e);
+    }
+}
+}
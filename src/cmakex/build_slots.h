@@ -0,0 +1,46 @@
+#ifndef BUILD_SLOTS_20398472
+#define BUILD_SLOTS_20398472
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+
+#include "using-decls.h"
+
+namespace cmakex {
+
+// Limits the number of cmake configure/build steps running at the same time. A single instance is
+// shared by the packages and configurations being built in parallel.
+class build_slots_t
+{
+public:
+    explicit build_slots_t(int n) : free_slots(n) {}
+
+    void acquire();
+    void release();
+
+private:
+    std::mutex mutex;
+    std::condition_variable cv;
+    int free_slots;
+};
+
+// holds a slot for its lifetime
+class build_slot_guard_t
+{
+public:
+    explicit build_slot_guard_t(build_slots_t& slots) : slots(slots) { slots.acquire(); }
+    ~build_slot_guard_t() { slots.release(); }
+    build_slot_guard_t(const build_slot_guard_t&) = delete;
+    build_slot_guard_t& operator=(const build_slot_guard_t&) = delete;
+
+private:
+    build_slots_t& slots;
+};
+
+// Calls f(0) ... f(n-1) on separate threads, each one while holding a slot. Waits for all of them
+// then rethrows the first exception, if any.
+void run_with_build_slots(int n, build_slots_t& slots, const std::function<void(int)>& f);
+}
+
+#endif
@@ -8,12 +8,50 @@
 #include "filesystem.h"
 #include "git.h"
 #include "git.h"
+#include "git_refs.h"
 #include "misc_utils.h"
 #include "print.h"
 
 namespace cmakex {
 
 namespace fs = filesystem;
+
+namespace {
+// `git status` takes long on large clones, so the HEAD and the index of each clone are remembered
+// (in the cmakex dir) when it's found clean. While they're the same and the work tree matches the
+// index there's nothing to check.
+bool clone_is_clean_or_untracked_only(string_par binary_dir,
+                                      string_par pkg_name,
+                                      string_par clone_dir,
+                                      string_par head_sha)
+{
+    string stamp_path = stringf("%s/clean_clones/%s.txt",
+                                cmakex_config_t(binary_dir).cmakex_dir().c_str(), pkg_name.c_str());
+    auto index_stamp = git_index_stamp(clone_dir);
+    if (!index_stamp.empty() && fs::is_regular_file(stamp_path) &&
+        must_read_file_as_lines(stamp_path) == vector<string>{head_sha.str(), index_stamp} &&
+        git_work_tree_matches_index(clone_dir))
+        return true;
+
+    // untracked files don't count, don't look for them
+    bool clean = git_status(clone_dir, false, false).clean_or_untracked_only();
+    try {
+        // git status may have refreshed the index
+        index_stamp = git_index_stamp(clone_dir);
+        if (clean && !index_stamp.empty()) {
+            fs::create_directories(fs::path(stamp_path).parent_path());
+            auto f = must_fopen(stamp_path, "w");
+            must_fprintf(f, "%s\n%s\n", head_sha.c_str(), index_stamp.c_str());
+        } else if (fs::exists(stamp_path))
+            fs::remove(stamp_path);
+    } catch (const exception& e) {
+        log_warn("Can't save the status of the clone of %s, reason: %s",
+                 pkg_for_log(pkg_name).c_str(), e.what());
+    }
+    return clean;
+}
+}
+
 // returns the package's clone dir's status, SHA, if git
 tuple<pkg_clone_dir_status_t, string> pkg_clone_dir_status(string_par binary_dir,
                                                            string_par pkg_name)
@@ -33,11 +71,10 @@ tuple<pkg_clone_dir_status_t, string> pkg_clone_dir_status(string_par binary_dir
     if (sha.empty())
         return make_tuple(pkg_clone_dir_nonempty_nongit, string{});
     // so it has valid sha
-    auto git_status_result = git_status(clone_dir);
-    return make_tuple(
-        move(git_status_result.clean_or_untracked_only() ? pkg_clone_dir_git
-                                                         : pkg_clone_dir_git_local_changes),
-        move(sha));
+    return make_tuple(clone_is_clean_or_untracked_only(binary_dir, pkg_name, clone_dir, sha)
+                          ? pkg_clone_dir_git
+                          : pkg_clone_dir_git_local_changes,
+                      move(sha));
 }
 void clone(string_par pkg_name,
            const pkg_clone_pars_t& cp,
@@ -49,6 +86,13 @@ void clone(string_par pkg_name,
 
     cmakex_config_t cfg(binary_dir);
     string clone_dir = cfg.pkg_clone_dir(pkg_name);
+    // the objects already in the shared mirror are not downloaded and stored again
+    const string mirror = git_mirror_of_url(cp.git_url);
+    auto git_clone_with_mirror = [&mirror](vector<string> args) {
+        if (!mirror.empty())
+            args.insert(args.begin(), {"--reference", mirror});
+        git_clone(args);
+    };
     vector<string> clone_args = {"--recurse"};
     bool do_checkout = false;
     if (cp.git_tag.empty()) {
@@ -76,7 +120,7 @@ void clone(string_par pkg_name,
                     vector<string> args = {"--recurse",      "--branch", git_tag.c_str(),
                                            "--depth",        "1",        cp.git_url.c_str(),
                                            clone_dir.c_str()};
-                    git_clone(args);
+                    git_clone_with_mirror(args);
                     if (git_checkout({cp.git_tag}, clone_dir) == 0)
                         return;
 
@@ -84,7 +128,7 @@ void clone(string_par pkg_name,
                     fs::remove_all(clone_dir);
                     args = {"--recurse", "--branch", git_tag.c_str(), cp.git_url.c_str(),
                             clone_dir.c_str()};
-                    git_clone(args);
+                    git_clone_with_mirror(args);
                     if (git_checkout({cp.git_tag}, clone_dir) == 0)
                         return;
 
@@ -100,7 +144,7 @@ void clone(string_par pkg_name,
         }
     }
     append_inplace(clone_args, vector<string>({cp.git_url.c_str(), clone_dir.c_str()}));
-    git_clone(clone_args);
+    git_clone_with_mirror(clone_args);
     if (do_checkout) {
         if (git_checkout({cp.git_tag}, clone_dir) != 0) {
             fs::remove_all(clone_dir.c_str());
@@ -334,4 +378,114 @@ void clone_helper_t::update_clone_status_vars()
             CHECK(false);
     }
 }
+
+clone_prefetcher_t::clone_prefetcher_t(string_par binary_dir, int jobs)
+    : binary_dir(binary_dir.str()), jobs(jobs)
+{
+    CHECK(jobs > 0);
+}
+
+clone_prefetcher_t::~clone_prefetcher_t()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+        queue.clear();
+    }
+    cv.notify_all();
+    for (auto& t : threads)
+        t.join();
+}
+
+void clone_prefetcher_t::prefetch(string_par pkg_name,
+                                  const pkg_clone_pars_t& c,
+                                  bool git_shallow)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (states.count(pkg_name.str()) > 0)
+            return;
+        states[pkg_name.str()] = state_queued;
+        queue.push_back(item_t{pkg_name.str(), c, git_shallow});
+        // threads are started on demand
+        if (threads.size() < jobs && threads.size() < queue.size())
+            threads.emplace_back(&clone_prefetcher_t::worker, this);
+    }
+    cv.notify_one();
+}
+
+void clone_prefetcher_t::wait(string_par pkg_name)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    auto it = states.find(pkg_name.str());
+    if (it == states.end())
+        return;
+    if (it->second == state_queued) {
+        // the caller will clone it itself
+        queue.erase(std::find_if(BEGINEND(queue), [&pkg_name](const item_t& x) {
+            return x.pkg_name == pkg_name.str();
+        }));
+        it->second = state_done;
+        return;
+    }
+    cv.wait(lock, [this, &pkg_name]() { return states.at(pkg_name.str()) == state_done; });
+}
+
+void clone_prefetcher_t::wait_finished(string_par pkg_name)
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    if (states.count(pkg_name.str()) == 0)
+        return;
+    cv.wait(lock, [this, &pkg_name]() { return states.at(pkg_name.str()) == state_done; });
+}
+
+void clone_prefetcher_t::worker()
+{
+    std::unique_lock<std::mutex> lock(mutex);
+    for (;;) {
+        cv.wait(lock, [this]() { return stopping || !queue.empty(); });
+        if (queue.empty())
+            return;  // stopping
+        auto item = move(queue.front());
+        queue.pop_front();
+        states[item.pkg_name] = state_running;
+        lock.unlock();
+
+        // for an existing clone this runs the git status in parallel with the other workers, the
+        // result is remembered for the processing of the package if it's clean
+        string msg;
+        bool cloning = false;
+        try {
+            auto cs = get<0>(pkg_clone_dir_status(binary_dir, item.pkg_name));
+            if (cs == pkg_clone_dir_doesnt_exist || cs == pkg_clone_dir_empty) {
+                cloning = true;
+                cmakex::clone(item.pkg_name, item.c, item.git_shallow, binary_dir);
+            }
+        } catch (const exception& e) {
+            msg = e.what();
+        } catch (...) {
+            msg = "unknown exception";
+        }
+        if (!msg.empty()) {
+            if (cloning) {
+                log_warn("Prefetching %s failed (%s), it will be cloned again.",
+                         pkg_for_log(item.pkg_name).c_str(), msg.c_str());
+                string clone_dir = cmakex_config_t(binary_dir).pkg_clone_dir(item.pkg_name);
+                try {
+                    fs::remove_all(clone_dir);
+                } catch (...) {
+                }
+            } else {
+                // the existing clone is left alone, it's checked again when the package is
+                // processed
+                log_verbose("Checking the clone of %s in advance failed (%s).",
+                            pkg_for_log(item.pkg_name).c_str(), msg.c_str());
+            }
+        }
+
+        lock.lock();
+        states[item.pkg_name] = state_done;
+        cv.notify_all();
+    }
+}
 }
@@ -1,6 +1,11 @@
 #ifndef CLONE_20394702934
 #define CLONE_20394702934
 
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
 #include "cmakex-types.h"
 #include "using-decls.h"
 
@@ -60,6 +65,49 @@ private:
     const string binary_dir;
     const string pkg_name;
 };
+
+// Clones packages in the background, at most `jobs` at the same time, so the dependency recursion
+// finds them already cloned. A failed prefetch is not an error: the clone dir is removed and the
+// recursion clones the package the usual way.
+class clone_prefetcher_t
+{
+public:
+    clone_prefetcher_t(string_par binary_dir, int jobs);
+    ~clone_prefetcher_t();  // drops the queued clones and waits for the running ones
+
+    // schedules cloning the package if it's not yet cloned or scheduled
+    void prefetch(string_par pkg_name, const pkg_clone_pars_t& c, bool git_shallow);
+    // returns when the package is not being cloned by the prefetcher (any more), unschedules it
+    // if it's not yet started
+    void wait(string_par pkg_name);
+    // returns when the prefetcher has finished with the package, doesn't unschedule it
+    void wait_finished(string_par pkg_name);
+
+private:
+    enum state_t
+    {
+        state_queued,
+        state_running,
+        state_done
+    };
+    struct item_t
+    {
+        string pkg_name;
+        pkg_clone_pars_t c;
+        bool git_shallow;
+    };
+
+    void worker();
+
+    const string binary_dir;
+    const int jobs;
+    std::mutex mutex;
+    std::condition_variable cv;
+    std::deque<item_t> queue;
+    std::map<string, state_t> states;
+    bool stopping = false;
+    vector<std::thread> threads;
+};
 }
 
 #endif
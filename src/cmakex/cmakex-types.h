@@ -13,6 +13,7 @@ static const char* const k_deps_script_filename = "deps.cmake";
 static const char* const k_log_extension = ".log";
 static const char* const k_cmakex_cache_filename = "cmakex_cache.json";
 static const char* const k_cmake_cache_tracker_filename = "cmakex_cache_tracker.json";
+static const char* const k_main_project_log_prefix = "_main";
 
 enum git_tag_kind_t
 {
@@ -148,7 +149,14 @@ struct installed_pkg_configs_t
     bool empty() const { return config_descs.empty(); }
     string sha() const;  // of this structure
 
+    // adds or replaces the config and updates config_shas
+    void put(installed_config_desc_t desc);
+    bool erase(const config_name_t& config);  // returns true if the config was present
+    // calc_sha of the desc of an existing config
+    const string& config_sha(const config_name_t& config) const { return config_shas.at(config); }
+
     std::map<config_name_t, installed_config_desc_t> config_descs;
+    std::map<config_name_t, string> config_shas;  // calculated once, when the desc is put
 };
 
 /*struct pkg_files_t {
@@ -202,6 +210,23 @@ enum UpdateMode
     update_mode_force
 };
 
+// where the dependencies come from, see --package-source-policy
+enum PackageSourcePolicy
+{
+    package_source_local_build,
+    package_source_try_server_build,
+    package_source_server_build,
+    package_source_force_server_build
+};
+
+// see --installdb-format
+enum InstallDBFormat
+{
+    installdb_format_unchanged,
+    installdb_format_json,
+    installdb_format_binary
+};
+
 struct base_command_line_args_cmake_mode_t
 {
     bool flag_c = false;
@@ -222,6 +247,15 @@ struct base_command_line_args_cmake_mode_t
     string deps_build_dir;
     string deps_install_dir;
     UpdateMode update_mode = update_mode_none;
+    int pkg_jobs = 1;  // max number of dependencies built in parallel
+    bool parallel_configs = false;
+    int clone_jobs = 1;  // max number of dependencies cloned in parallel, 1: no prefetching
+    int jobserver_jobs = 0;       // size of the jobserver's token pool, 0 if there's no jobserver
+    int ls_remote_cache_ttl = 0;  // seconds, 0 if the ls-remote disk cache is disabled
+    string binary_cache_dir;      // empty: CMAKEX_BINARY_CACHE_DIR or no binary cache
+    PackageSourcePolicy package_source_policy = package_source_local_build;
+    string package_repository;  // empty: CMAKEX_PACKAGE_REPOSITORY
+    InstallDBFormat installdb_format = installdb_format_unchanged;
 };
 
 struct command_line_args_cmake_mode_t : base_command_line_args_cmake_mode_t
@@ -1,5 +1,7 @@
 #include "cmakex_utils.h"
 
+#include <mutex>
+
 #include <adasworks/sx/algorithm.h>
 
 #include "cereal_utils.h"
@@ -7,6 +9,7 @@
 #include "misc_utils.h"
 #include "print.h"
 #include "resource.h"
+#include "run_fingerprint.h"
 #include "out_err_messages.h"
 
 CEREAL_CLASS_VERSION(cmakex::cmakex_cache_t, 2)
@@ -71,9 +74,11 @@ void cmake_cache_tracker_t::confirm_pending()
 
         if (pca.switch_ == "-C") {
             c_sha = file_sha(pca.value);
+            watch_file_for_run_fingerprint(pca.value);
         } else if (pca.name == "CMAKE_TOOLCHAIN_FILE") {
             if (pca.switch_ == "-D") {
                 cmake_toolchain_file_sha = file_sha(pca.value);
+                watch_file_for_run_fingerprint(pca.value);
             } else if (pca.switch_ == "-U") {
                 cmake_toolchain_file_sha.clear();
             } else {
@@ -660,6 +665,38 @@ cmake_cache_t read_cmake_cache(string_par path)
     }
     return cache;
 }
+cmake_cache_t read_whole_cmake_cache(string_par path)
+{
+    cmake_cache_t cache;
+    auto f = must_fopen(path, "r");
+    while (!feof(f)) {
+        auto line = must_fgetline_if_not_eof(f);
+        if (line.empty() || line[0] == '#' || starts_with(line, "//"))
+            continue;
+        // NAME:TYPE=VALUE, the name may be quoted
+        string::size_type name_end = 0;
+        string name;
+        if (line[0] == '"') {
+            name_end = line.find('"', 1);
+            if (name_end == string::npos)
+                continue;
+            name = line.substr(1, name_end - 1);
+            ++name_end;
+        } else {
+            name_end = line.find_first_of(":=");
+            if (name_end == string::npos)
+                continue;
+            name = line.substr(0, name_end);
+        }
+        auto equal_pos = line.find('=', name_end);
+        if (equal_pos == string::npos)
+            continue;
+        if (line[name_end] == ':')
+            cache.types[name] = line.substr(name_end + 1, equal_pos - name_end - 1);
+        cache.vars[name] = line.substr(equal_pos + 1);
+    }
+    return cache;
+}
 void write_hijack_module(string_par pkg_name, string_par binary_dir)
 {
     cmakex_config_t cfg(binary_dir);
@@ -799,10 +836,15 @@ string escape_command_line_arg(string_par x)
         result = stringf("\"%s\"", result.c_str());
     return result;
 }
+namespace {
+std::mutex s_cmake_version_mutex;
+string s_cmake_version;  // first line of `cmake --version`, empty until cmake is found
+}
+
 void test_cmake()
 {
-    static bool cmake_found = false;
-    if (cmake_found)
+    std::lock_guard<std::mutex> lock(s_cmake_version_mutex);
+    if (!s_cmake_version.empty())
         return;
 
     OutErrMessagesBuilder oeb(pipe_capture, pipe_capture);
@@ -824,13 +866,21 @@ void test_cmake()
         throwf("Can't find cmake executable on the path. Error code: %d, PATH: %s", r,
                p ? p : "<null>");
     } else {
+        s_cmake_version = "cmake";
         if (oem.size() >= 1) {
-            auto msg = oem.at(0);
-            auto pos = std::min(msg.text.find('\n'), msg.text.find('\r'));
-            if (pos != string::npos)
-                msg.text = msg.text.substr(0, pos);
-            printf("%s\n", msg.text.c_str());
+            auto lines = split_lines(oem.at(0).text);
+            string first_line = lines.empty() ? string() : make_string(lines[0]);
+            printf("%s\n", first_line.c_str());
+            if (!first_line.empty())
+                s_cmake_version = first_line;
         }
     }
 }
+
+string cmake_version()
+{
+    test_cmake();
+    std::lock_guard<std::mutex> lock(s_cmake_version_mutex);
+    return s_cmake_version;
+}
 }
@@ -110,6 +110,8 @@ tuple<vector<string>, bool> cmake_args_prepend_existing_cmake_path_variable(
     string_par dir);
 vector<string> cmakex_prefix_path_to_vector(string_par x, bool env_var);
 cmake_cache_t read_cmake_cache(string_par path);
+// reads all the entries, read_cmake_cache reads only the few ones cmakex needs
+cmake_cache_t read_whole_cmake_cache(string_par path);
 void write_hijack_module(string_par pkg_name, string_par binary_dir);
 const string* find_specific_cmake_arg_or_null(string_par cmake_var_name,
                                               const vector<string>& cmake_args);
@@ -129,7 +131,10 @@ string escape_command_line_arg(string_par x);
 
 bool eval_cmake_boolean_or_fail(string_par x);
 
+// runs `cmake --version` once per process, throws if cmake is not found
 void test_cmake();
+// first line of `cmake --version`
+string cmake_version();
 }
 
 #endif
@@ -0,0 +1,869 @@
+#include "deps_script_evaluator.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <set>
+
+#include <nowide/cstdlib.hpp>
+
+#include "filesystem.h"
+#include "misc_utils.h"
+#include "print.h"
+
+namespace cmakex {
+
+namespace fs = filesystem;
+
+namespace {
+
+// thrown if the script can't be evaluated without cmake
+struct unsupported_t
+{
+    string reason;
+};
+
+enum raw_arg_kind_t
+{
+    raw_arg_unquoted,
+    raw_arg_quoted,
+    raw_arg_bracket
+};
+
+// an argument as written in the script (escapes and variable references not yet evaluated)
+struct raw_arg_t
+{
+    raw_arg_kind_t kind;
+    string text;
+};
+
+struct command_t
+{
+    string name;  // lowercase
+    vector<raw_arg_t> args;
+    int line;
+};
+
+// evaluated argument
+struct arg_t
+{
+    string value;
+    bool quoted;  // quoted or bracket argument, not subject to list expansion and auto-dereference
+};
+
+const std::set<string> k_supported_commands = {"add_pkg", "def_pkg", "set",  "unset", "message",
+                                               "if",      "elseif",  "else", "endif"};
+
+// the commands which can't change anything outside the scope of the script (set and unset without
+// CACHE and PARENT_SCOPE)
+const std::set<string> k_scope_local_commands = {
+    "add_pkg", "def_pkg", "set", "unset", "message", "if", "elseif", "else", "endif", "foreach",
+    "endforeach", "while", "endwhile", "break", "continue", "return", "list", "string", "math",
+    "get_filename_component"};
+
+// parses the CMake language (the grammar of cmake-language(7)) into a list of commands
+class parser_t
+{
+public:
+    explicit parser_t(const string& s) : s(s) {}
+
+    vector<command_t> parse()
+    {
+        vector<command_t> commands;
+        if (starts_with(s, "\xEF\xBB\xBF"))
+            i = 3;
+        for (;;) {
+            skip_spaces_and_bracket_comments();
+            if (eof())
+                break;
+            char c = peek();
+            if (c == '#') {
+                skip_comment();
+            } else if (c == '\n') {
+                advance();
+            } else if (isalpha((unsigned char)c) || c == '_') {
+                commands.emplace_back(parse_command());
+                skip_spaces_and_bracket_comments();
+                if (!eof() && peek() != '\n' && peek() != '#')
+                    error("expected newline after the command");
+            } else
+                error("unexpected character");
+        }
+        return commands;
+    }
+
+private:
+    const string& s;
+    size_t i = 0;
+    int line = 1;
+
+    [[noreturn]] void error(const char* what) const
+    {
+        throw unsupported_t{stringf("parse error at line %d: %s", line, what)};
+    }
+    bool eof() const { return i >= s.size(); }
+    char peek(size_t k = 0) const { return i + k < s.size() ? s[i + k] : 0; }
+    void advance()
+    {
+        if (s[i] == '\n')
+            ++line;
+        ++i;
+    }
+    static bool is_space(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+    // returns the number of '='s if a bracket ("[", "="*, "[") opens at the current position + k0
+    int bracket_open_length(size_t k0 = 0) const
+    {
+        if (peek(k0) != '[')
+            return -1;
+        size_t k = k0 + 1;
+        while (peek(k) == '=')
+            ++k;
+        return peek(k) == '[' ? int(k - k0 - 1) : -1;
+    }
+    // reads the content of the bracket opening at the current position
+    string read_bracket(int n)
+    {
+        i += n + 2;
+        string close = "]" + string(n, '=') + "]";
+        auto e = s.find(close, i);
+        if (e == string::npos)
+            error("unterminated bracket");
+        string r = s.substr(i, e - i);
+        while (i < e)
+            advance();
+        i = e + close.size();
+        // the first newline after the opening bracket is ignored
+        if (starts_with(r, "\r\n"))
+            r.erase(0, 2);
+        else if (starts_with(r, '\n'))
+            r.erase(0, 1);
+        return r;
+    }
+    // at '#'
+    void skip_comment()
+    {
+        ++i;
+        int n = bracket_open_length();
+        if (n >= 0) {
+            read_bracket(n);
+            return;
+        }
+        while (!eof() && peek() != '\n')
+            ++i;
+    }
+    void skip_spaces_and_bracket_comments()
+    {
+        for (;;) {
+            if (is_space(peek()))
+                ++i;
+            else if (peek() == '#' && bracket_open_length(1) >= 0) {
+                ++i;
+                read_bracket(bracket_open_length());
+            } else
+                return;
+        }
+    }
+
+    command_t parse_command()
+    {
+        command_t c;
+        c.line = line;
+        while (isalnum((unsigned char)peek()) || peek() == '_')
+            c.name.push_back(s[i++]);
+        tolower_inplace(c.name);
+        while (is_space(peek()))
+            ++i;
+        if (peek() != '(')
+            error("expected '('");
+        ++i;
+        int depth = 0;
+        for (;;) {
+            if (eof())
+                error("unterminated command");
+            char ch = peek();
+            if (is_space(ch) || ch == '\n')
+                advance();
+            else if (ch == '#')
+                skip_comment();
+            else if (ch == '(') {
+                ++depth;
+                ++i;
+                c.args.emplace_back(raw_arg_t{raw_arg_unquoted, "("});
+            } else if (ch == ')') {
+                ++i;
+                if (depth == 0)
+                    break;
+                --depth;
+                c.args.emplace_back(raw_arg_t{raw_arg_unquoted, ")"});
+            } else if (ch == '"') {
+                c.args.emplace_back(raw_arg_t{raw_arg_quoted, read_quoted()});
+            } else if (bracket_open_length() >= 0) {
+                c.args.emplace_back(
+                    raw_arg_t{raw_arg_bracket, read_bracket(bracket_open_length())});
+            } else
+                c.args.emplace_back(raw_arg_t{raw_arg_unquoted, read_unquoted()});
+        }
+        return c;
+    }
+    // at '"', returns the text between the quotes
+    string read_quoted()
+    {
+        ++i;
+        string r;
+        for (;;) {
+            if (eof())
+                error("unterminated quoted argument");
+            char ch = peek();
+            if (ch == '"') {
+                ++i;
+                return r;
+            }
+            r.push_back(ch);
+            advance();
+            if (ch == '\\' && !eof()) {
+                r.push_back(peek());
+                advance();
+            }
+        }
+    }
+    string read_unquoted()
+    {
+        string r;
+        for (;;) {
+            char ch = peek();
+            if (eof() || is_space(ch) || ch == '\n' || ch == '(' || ch == ')' || ch == '#')
+                return r;
+            if (ch == '"')
+                error("quote in unquoted argument");
+            r.push_back(ch);
+            ++i;
+            if (ch == '\\') {
+                if (eof())
+                    error("escape at end of file");
+                r.push_back(peek());
+                advance();
+            }
+        }
+    }
+};
+
+bool is_on_constant(string_par x)
+{
+    return tolower_equals(x, "1") || tolower_equals(x, "on") || tolower_equals(x, "yes") ||
+           tolower_equals(x, "true") || tolower_equals(x, "y");
+}
+
+bool is_off_constant(string_par x)
+{
+    for (auto c : {"0", "off", "no", "false", "n", "ignore", "notfound", ""}) {
+        if (tolower_equals(x, c))
+            return true;
+    }
+    return x.size() >= 9 && tolower_equals(x.c_str() + x.size() - 9, "-notfound");
+}
+
+// cmSystemTools::VersionCompare
+int version_compare(const char* l, const char* r)
+{
+    while (isdigit((unsigned char)*l) || isdigit((unsigned char)*r)) {
+        char* le;
+        char* re;
+        auto lv = strtoul(l, &le, 10);
+        auto rv = strtoul(r, &re, 10);
+        if (lv != rv)
+            return lv < rv ? -1 : 1;
+        l = le;
+        r = re;
+        if (*l == '.')
+            ++l;
+        if (*r == '.')
+            ++r;
+    }
+    return 0;
+}
+
+bool is_absolute_path(const string& x)
+{
+#ifdef _WIN32
+    return (x.size() >= 2 && x[1] == ':') || starts_with(x, '/') || starts_with(x, '\\');
+#else
+    return starts_with(x, '/') || starts_with(x, '~');
+#endif
+}
+
+class evaluator_t
+{
+public:
+    evaluator_t(string_par deps_script_file, const std::map<string, string>& cmake_cache_vars)
+        : cmake_cache_vars(cmake_cache_vars)
+    {
+        string file = deps_script_file.str();
+        std::replace(file.begin(), file.end(), '\\', '/');
+        vars["CMAKE_CURRENT_LIST_FILE"] = file;
+        vars["CMAKE_CURRENT_LIST_DIR"] = file.substr(0, file.rfind('/'));
+
+        // the toolchain and the project include files can define any variable, a target system
+        // set on the command line (cross build) changes UNIX, WIN32, APPLE, etc..
+        for (auto& kv : cmake_cache_vars) {
+            if (!kv.second.empty() &&
+                (kv.first == "CMAKE_TOOLCHAIN_FILE" || kv.first == "CMAKE_SYSTEM_NAME" ||
+                 kv.first == "CMAKE_CROSSCOMPILING" ||
+                 starts_with(kv.first, "CMAKE_USER_MAKE_RULES_OVERRIDE") ||
+                 (starts_with(kv.first, "CMAKE_PROJECT_") &&
+                  (ends_with(kv.first, "_INCLUDE") || ends_with(kv.first, "_INCLUDE_BEFORE") ||
+                   ends_with(kv.first, "_INCLUDES")))))
+                opaque_variables = true;
+        }
+        if (!opaque_variables) {
+#if defined(_WIN32)
+            vars["WIN32"] = "1";
+            undefined_vars = {"UNIX", "APPLE", "IOS", "ANDROID"};
+#elif !defined(__CYGWIN__)
+            vars["UNIX"] = "1";
+#ifdef __APPLE__
+            vars["APPLE"] = "1";
+#else
+            undefined_vars.insert("APPLE");
+#endif
+            for (auto v : {"WIN32", "WINCE", "WINDOWS_PHONE", "WINDOWS_STORE", "MSVC", "MINGW",
+                           "MSYS", "CYGWIN", "BORLAND", "WATCOM", "IOS", "ANDROID"})
+                undefined_vars.insert(v);
+#endif
+        }
+    }
+
+    vector<string> run(const vector<command_t>& commands)
+    {
+        for (auto& c : commands) {
+            if (k_supported_commands.count(c.name) == 0)
+                throw unsupported_t{
+                    stringf("unsupported command '%s' at line %d", c.name.c_str(), c.line)};
+        }
+        run_block(commands, 0, commands.size());
+        return move(lines);
+    }
+
+    // returns the value of the variable or nothing if it's surely not defined, throws if it may be
+    // defined by cmake, the wrapper project or a toolchain file
+    maybe<string> lookup(const string& name) const
+    {
+        auto it = vars.find(name);
+        if (it != vars.end())
+            return just(it->second);
+        if (undefined_vars.count(name))
+            return {};
+        bool cache_var_visible =
+            !opaque_variables &&
+            (!may_be_defined_by_cmake(name) ||
+             is_one_of(name, {"CMAKE_BUILD_TYPE", "CMAKE_INSTALL_PREFIX", "CMAKE_PREFIX_PATH",
+                              "CMAKEX_VERSION"}));
+        if (!cache_var_visible)
+            throw unsupported_t{stringf("can't tell the value of the variable '%s'", name.c_str())};
+        auto itc = cmake_cache_vars.find(name);
+        if (itc != cmake_cache_vars.end())
+            return just(itc->second);
+        return {};
+    }
+
+    const std::map<string, string>& cache_vars() const { return cmake_cache_vars; }
+
+private:
+    const std::map<string, string>& cmake_cache_vars;
+    std::map<string, string> vars;  // set by the script plus the builtin ones
+    std::set<string> undefined_vars;
+    bool opaque_variables = false;
+    vector<string> lines;  // the add_pkg/def_pkg lines
+
+    static bool may_be_defined_by_cmake(const string& name)
+    {
+        // variables of cmake, the implicit project() and of the wrapper project
+        for (auto p : {"CMAKE", "_CMAKE", "__CMAKE", "PROJECT_", "Project_", "MSVC", "ARGV",
+                       "XCODE"}) {
+            if (starts_with(name, p))
+                return true;
+        }
+        return is_one_of(name, {"ARGC", "ARGN", "UNIX", "WIN32", "APPLE", "LINUX", "BSD", "IOS",
+                                "ANDROID", "MINGW", "MSYS", "CYGWIN", "BORLAND", "WATCOM", "WINCE",
+                                "WINDOWS_PHONE", "WINDOWS_STORE", "GHSMULTI", "command", "verb",
+                                "l", "r", "last", "i", "i1", "i2", "i3", "pkg", "path", "out",
+                                "included_files_out", "f", "_d"});
+    }
+
+    void run_block(const vector<command_t>& commands, size_t begin, size_t end)
+    {
+        for (size_t k = begin; k < end; ++k) {
+            auto& c = commands[k];
+            if (c.name == "if") {
+                auto branches = find_if_branches(commands, k, end);
+                for (size_t b = 0; b + 1 < branches.size(); ++b) {
+                    auto& bc = commands[branches[b]];
+                    if (bc.name == "else" || evaluate_condition(expand_args(bc))) {
+                        run_block(commands, branches[b] + 1, branches[b + 1]);
+                        break;
+                    }
+                }
+                k = branches.back();
+            } else if (c.name == "elseif" || c.name == "else" || c.name == "endif")
+                throw unsupported_t{
+                    stringf("'%s' without 'if' at line %d", c.name.c_str(), c.line)};
+            else
+                execute(c, expand_args(c));
+        }
+    }
+
+    // returns the indices of the if, elseif, else and endif commands of the if block at `k`
+    static vector<size_t> find_if_branches(const vector<command_t>& commands,
+                                           size_t k,
+                                           size_t end)
+    {
+        vector<size_t> r = {k};
+        int depth = 0;
+        bool had_else = false;
+        for (size_t j = k + 1; j < end; ++j) {
+            auto& n = commands[j].name;
+            if (n == "if")
+                ++depth;
+            else if (n == "endif") {
+                if (depth == 0) {
+                    r.push_back(j);
+                    return r;
+                }
+                --depth;
+            } else if (depth == 0 && (n == "elseif" || n == "else")) {
+                if (had_else)
+                    break;
+                had_else = n == "else";
+                r.push_back(j);
+            }
+        }
+        throw unsupported_t{stringf("unmatched 'if' at line %d", commands[k].line)};
+    }
+
+    void execute(const command_t& c, const vector<arg_t>& args)
+    {
+        if (c.name == "add_pkg" || c.name == "def_pkg") {
+            if (args.empty() || args[0].value.empty() || args[0].value.find(';') != string::npos)
+                throw unsupported_t{stringf("invalid package name at line %d", c.line)};
+            string line = args[0].value;
+            if (c.name == "def_pkg")
+                line += "\tDEFINE_ONLY";
+            for (size_t k = 1; k < args.size(); ++k) {
+                // the wrapper iterates over ARGN as a list
+                if (args[k].value.empty() || args[k].value.find(';') != string::npos)
+                    throw unsupported_t{stringf("empty or list argument at line %d", c.line)};
+                line += "\t" + args[k].value;
+            }
+            if (line.find_first_of("\r\n") != string::npos)
+                throw unsupported_t{stringf("newline in argument at line %d", c.line)};
+            lines.emplace_back(move(line));
+        } else if (c.name == "set" || c.name == "unset") {
+            if (args.empty() || starts_with(args[0].value, "ENV{") ||
+                (c.name == "unset" && args.size() > 1))
+                throw unsupported_t{stringf("unsupported '%s' at line %d", c.name.c_str(), c.line)};
+            vector<string> values;
+            for (size_t k = 1; k < args.size(); ++k) {
+                if (args[k].value == "CACHE" ||
+                    (k + 1 == args.size() && args[k].value == "PARENT_SCOPE"))
+                    throw unsupported_t{
+                        stringf("unsupported '%s' at line %d", c.name.c_str(), c.line)};
+                values.emplace_back(args[k].value);
+            }
+            if (values.empty())
+                vars.erase(args[0].value);
+            else
+                vars[args[0].value] = join(values, ";");
+        } else if (c.name == "message") {
+            // the output of the deps script is not shown, only the errors matter
+            if (!args.empty() &&
+                is_one_of(args[0].value, {"FATAL_ERROR", "SEND_ERROR", "AUTHOR_WARNING",
+                                          "DEPRECATION", "CONFIGURE_LOG"}))
+                throw unsupported_t{
+                    stringf("message(%s) at line %d", args[0].value.c_str(), c.line)};
+        } else
+            CHECK(false);
+    }
+
+    vector<arg_t> expand_args(const command_t& c) const
+    {
+        vector<arg_t> r;
+        for (auto& a : c.args) {
+            switch (a.kind) {
+                case raw_arg_bracket:
+                    r.emplace_back(arg_t{a.text, true});
+                    break;
+                case raw_arg_quoted:
+                    r.emplace_back(arg_t{expand(a.text, true, c.line), true});
+                    break;
+                case raw_arg_unquoted: {
+                    auto v = expand(a.text, false, c.line);
+                    if (v.find(';') != string::npos &&
+                        (v.find('[') != string::npos || v.find('\\') != string::npos))
+                        throw unsupported_t{stringf("complex list at line %d", c.line)};
+                    for (auto& x : split(v, ';')) {
+                        if (!x.empty())
+                            r.emplace_back(arg_t{x, false});
+                    }
+                } break;
+            }
+        }
+        return r;
+    }
+
+    // evaluates escape sequences and variable references
+    string expand(const string& x, bool quoted, int line) const
+    {
+        size_t i = 0;
+        return expand_until(x, i, quoted, line, 0);
+    }
+    string expand_until(const string& x, size_t& i, bool quoted, int line, char terminator) const
+    {
+        string r;
+        while (i < x.size()) {
+            char c = x[i];
+            if (terminator && c == terminator) {
+                ++i;
+                return r;
+            }
+            if (c == '\\') {
+                char e = i + 1 < x.size() ? x[i + 1] : 0;
+                i += 2;
+                if (e == 't')
+                    r.push_back('\t');
+                else if (e == 'n')
+                    r.push_back('\n');
+                else if (e == 'r')
+                    r.push_back('\r');
+                else if (e == '\n' && quoted && !terminator)
+                    ;  // line continuation
+                else if (e == 0 || e == ';' || isalnum((unsigned char)e))
+                    throw unsupported_t{stringf("escape sequence at line %d", line)};
+                else
+                    r.push_back(e);
+            } else if (c == '$' && x.compare(i, 2, "${") == 0) {
+                i += 2;
+                auto name = expand_variable_name(x, i, line);
+                auto v = lookup(name);
+                if (v)
+                    r += *v;
+            } else if (c == '$' && x.compare(i, 5, "$ENV{") == 0) {
+                i += 5;
+                auto name = expand_variable_name(x, i, line);
+                auto v = nowide::getenv(name.c_str());
+                if (v)
+                    r += v;
+            } else if (c == '$' && x.compare(i, 7, "$CACHE{") == 0) {
+                throw unsupported_t{stringf("$CACHE{} at line %d", line)};
+            } else {
+                if (terminator && !(isalnum((unsigned char)c) || strchr("/_.+-", c)))
+                    throw unsupported_t{stringf("invalid variable name at line %d", line)};
+                r.push_back(c);
+                ++i;
+            }
+        }
+        if (terminator)
+            throw unsupported_t{stringf("unterminated variable reference at line %d", line)};
+        return r;
+    }
+    string expand_variable_name(const string& x, size_t& i, int line) const
+    {
+        return expand_until(x, i, false, line, '}');
+    }
+
+    bool evaluate_condition(const vector<arg_t>& args) const;
+};
+
+// evaluates the arguments of if() and elseif(), see cmConditionEvaluator
+class condition_t
+{
+public:
+    condition_t(const evaluator_t& ev, const vector<arg_t>& args) : ev(ev), args(args) {}
+
+    bool evaluate()
+    {
+        if (args.empty())
+            return false;
+        bool r = and_or_expr();
+        if (k != args.size())
+            unsupported();
+        return r;
+    }
+
+private:
+    const evaluator_t& ev;
+    const vector<arg_t>& args;
+    size_t k = 0;
+
+    [[noreturn]] void unsupported() const
+    {
+        vector<string> v;
+        for (auto& a : args)
+            v.emplace_back(a.quoted ? "\"" + a.value + "\"" : a.value);
+        throw unsupported_t{stringf("unsupported condition: (%s)", join(v, " ").c_str())};
+    }
+
+    bool is_keyword(size_t j) const
+    {
+        static const std::set<string> keywords = {
+            "(", ")", "NOT", "AND", "OR", "DEFINED", "EXISTS", "COMMAND", "POLICY", "TARGET",
+            "TEST", "IS_DIRECTORY", "IS_ABSOLUTE", "IS_SYMLINK", "IS_NEWER_THAN", "MATCHES", "LESS",
+            "GREATER", "EQUAL", "LESS_EQUAL", "GREATER_EQUAL", "STRLESS", "STRGREATER", "STREQUAL",
+            "STRLESS_EQUAL", "STRGREATER_EQUAL", "VERSION_LESS", "VERSION_GREATER", "VERSION_EQUAL",
+            "VERSION_LESS_EQUAL", "VERSION_GREATER_EQUAL", "IN_LIST", "PATH_EQUAL"};
+        return j < args.size() && !args[j].quoted && keywords.count(args[j].value) > 0;
+    }
+    bool is(size_t j, const char* keyword) const
+    {
+        return j < args.size() && !args[j].quoted && args[j].value == keyword;
+    }
+    bool is_binary_operator(size_t j) const
+    {
+        return is_keyword(j) && (is(j, "MATCHES") || is(j, "IS_NEWER_THAN") || is(j, "IN_LIST") ||
+                                 is(j, "PATH_EQUAL") || is(j, "LESS") || is(j, "GREATER") ||
+                                 is(j, "EQUAL") || ends_with(args[j].value, "_EQUAL") ||
+                                 starts_with(args[j].value, "STR") ||
+                                 starts_with(args[j].value, "VERSION_"));
+    }
+    const arg_t& operand()
+    {
+        if (k >= args.size() || is_keyword(k))
+            unsupported();
+        return args[k++];
+    }
+    // the value of the variable if the argument is an unquoted variable name, the argument
+    // otherwise
+    string variable_or_string(const arg_t& a) const
+    {
+        if (!a.quoted) {
+            auto v = ev.lookup(a.value);
+            if (v)
+                return *v;
+        }
+        return a.value;
+    }
+
+    // AND and OR have the same precedence
+    bool and_or_expr()
+    {
+        bool r = not_expr();
+        while (is(k, "AND") || is(k, "OR")) {
+            bool is_and = is(k++, "AND");
+            bool rhs = not_expr();
+            r = is_and ? r && rhs : r || rhs;
+        }
+        return r;
+    }
+    bool not_expr()
+    {
+        if (is(k, "NOT")) {
+            ++k;
+            if (is(k, "NOT"))
+                unsupported();  // cmake rejects it
+            return !not_expr();
+        }
+        return binary_expr();
+    }
+    bool binary_expr()
+    {
+        bool r;
+        if (!is_keyword(k) && is_binary_operator(k + 1)) {
+            auto& lhs = args[k];
+            auto& op = args[k + 1].value;
+            k += 2;
+            auto& rhs = operand();
+            r = binary(lhs, op, rhs);
+        } else
+            r = unary_expr();
+        if (is_binary_operator(k))
+            unsupported();
+        return r;
+    }
+    bool binary(const arg_t& lhs, const string& op, const arg_t& rhs) const
+    {
+        if (op == "IN_LIST") {
+            auto list = ev.lookup(rhs.value);
+            if (!list)
+                return false;
+            if (list->find_first_of("[\\") != string::npos)
+                unsupported();
+            return linear_search(split(*list, ';'), variable_or_string(lhs));
+        }
+        auto l = variable_or_string(lhs);
+        auto r = variable_or_string(rhs);
+        if (op == "LESS" || op == "GREATER" || op == "EQUAL" || op == "LESS_EQUAL" ||
+            op == "GREATER_EQUAL") {
+            double ld, rd;
+            if (sscanf(l.c_str(), "%lg", &ld) != 1 || sscanf(r.c_str(), "%lg", &rd) != 1)
+                return false;
+            if (op == "LESS")
+                return ld < rd;
+            if (op == "GREATER")
+                return ld > rd;
+            if (op == "EQUAL")
+                return ld == rd;
+            if (op == "LESS_EQUAL")
+                return ld <= rd;
+            return ld >= rd;
+        }
+        int c;
+        string cmp_op;
+        if (starts_with(op, "STR")) {
+            c = l.compare(r);
+            cmp_op = op.substr(3);
+        } else if (starts_with(op, "VERSION_")) {
+            c = version_compare(l.c_str(), r.c_str());
+            cmp_op = op.substr(8);
+        } else
+            unsupported();  // MATCHES, IS_NEWER_THAN, PATH_EQUAL
+        if (cmp_op == "EQUAL")
+            return c == 0;
+        if (cmp_op == "LESS")
+            return c < 0;
+        if (cmp_op == "GREATER")
+            return c > 0;
+        if (cmp_op == "LESS_EQUAL")
+            return c <= 0;
+        if (cmp_op == "GREATER_EQUAL")
+            return c >= 0;
+        unsupported();
+    }
+    bool unary_expr()
+    {
+        if (is(k, "(")) {
+            ++k;
+            bool r = and_or_expr();
+            if (!is(k, ")"))
+                unsupported();
+            ++k;
+            return r;
+        }
+        if (is(k, "DEFINED")) {
+            ++k;
+            auto& name = operand().value;
+            if (starts_with(name, "ENV{") && ends_with(name, "}"))
+                return nowide::getenv(name.substr(4, name.size() - 5).c_str()) != nullptr;
+            if (starts_with(name, "CACHE{") && ends_with(name, "}"))
+                return ev.cache_vars().count(name.substr(6, name.size() - 7)) > 0;
+            return !!ev.lookup(name);
+        }
+        if (is(k, "EXISTS") || is(k, "IS_DIRECTORY") || is(k, "IS_ABSOLUTE")) {
+            auto& op = args[k++].value;
+            auto& path = operand().value;
+            if (op == "IS_ABSOLUTE")
+                return is_absolute_path(path);
+            if (path.empty())
+                return false;
+            return op == "EXISTS" ? fs::exists(path) : fs::is_directory(path);
+        }
+        return atom(operand());
+    }
+    bool atom(const arg_t& a) const
+    {
+        if (is_on_constant(a.value))
+            return true;
+        if (is_off_constant(a.value))
+            return false;
+        char* end;
+        double d = strtod(a.value.c_str(), &end);
+        if (*end == 0)
+            return d != 0;
+        if (a.quoted)
+            return false;
+        auto v = ev.lookup(a.value);
+        return v && !is_off_constant(*v);
+    }
+};
+
+bool evaluator_t::evaluate_condition(const vector<arg_t>& args) const
+{
+    return condition_t(*this, args).evaluate();
+}
+
+string read_text_file(string_par path)
+{
+    auto f = must_fopen(path, "rb");
+    string r;
+    char buf[4096];
+    for (;;) {
+        auto n = fread(buf, 1, sizeof(buf), f);
+        r.append(buf, n);
+        if (n < sizeof(buf)) {
+            if (ferror(f))
+                throwf("Read error in file %s.", path_for_log(path).c_str());
+            return r;
+        }
+    }
+}
+}
+
+bool deps_script_may_affect_later_scripts(string_par deps_script_file)
+{
+    try {
+        auto text = read_text_file(deps_script_file);
+        for (auto& c : parser_t(text).parse()) {
+            if (k_scope_local_commands.count(c.name) == 0)
+                return true;
+            if (c.name == "set" || c.name == "unset") {
+                // the environment is process-wide
+                if (!c.args.empty() && starts_with(c.args[0].text, "ENV{"))
+                    return true;
+                for (auto& a : c.args) {
+                    if (a.kind == raw_arg_unquoted && is_one_of(a.text, {"CACHE", "PARENT_SCOPE"}))
+                        return true;
+                }
+            }
+        }
+        return false;
+    } catch (...) {
+        return true;
+    }
+}
+
+bool deps_script_may_depend_on_environment(string_par deps_script_file)
+{
+    try {
+        auto text = read_text_file(deps_script_file);
+        for (auto& c : parser_t(text).parse()) {
+            if (is_one_of(c.name, {"file", "find_file", "find_library", "find_package", "find_path",
+                                   "find_program", "execute_process", "exec_program",
+                                   "cmake_host_system_information"}))
+                return true;
+            for (auto& a : c.args) {
+                if (a.kind != raw_arg_bracket && a.text.find("$ENV{") != string::npos)
+                    return true;
+                if (a.kind != raw_arg_unquoted)
+                    continue;
+                if (c.name == "include" && a.text == "OPTIONAL")
+                    return true;
+                if (is_one_of(c.name, {"if", "elseif", "while"}) &&
+                    (starts_with(a.text, "ENV{") ||
+                     is_one_of(a.text, {"EXISTS", "IS_DIRECTORY", "IS_SYMLINK", "IS_NEWER_THAN"})))
+                    return true;
+            }
+        }
+        return false;
+    } catch (...) {
+        return true;
+    }
+}
+
+maybe<vector<string>> evaluate_deps_script_natively(
+    string_par deps_script_file,
+    const std::map<string, string>& cmake_cache_vars)
+{
+    try {
+        if (!fs::path(deps_script_file.c_str()).is_absolute())
+            throw unsupported_t{"relative path"};
+        auto text = read_text_file(deps_script_file);
+        auto commands = parser_t(text).parse();
+        return just(evaluator_t(deps_script_file, cmake_cache_vars).run(commands));
+    } catch (const unsupported_t& u) {
+        log_verbose("The dependency script is evaluated by cmake, reason: %s.", u.reason.c_str());
+    } catch (const exception& e) {
+        log_verbose("The dependency script is evaluated by cmake, reason: %s", e.what());
+    }
+    return {};
+}
+}
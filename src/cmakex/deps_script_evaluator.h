@@ -0,0 +1,34 @@
+#ifndef DEPS_SCRIPT_EVALUATOR_2309472034
+#define DEPS_SCRIPT_EVALUATOR_2309472034
+
+#include <map>
+
+#include "using-decls.h"
+
+namespace cmakex {
+
+// Evaluates the deps script in-process if it uses only the common subset of the CMake language:
+// add_pkg, def_pkg, set, unset, message (non-error modes) and if/elseif/else/endif. The script
+// sees the variables of `cmake_cache_vars` (the CMakeCache.txt of the wrapper project) and
+// CMAKE_CURRENT_LIST_DIR/FILE.
+// Returns the add_pkg/def_pkg lines, the same ones the wrapper project would write, or nothing if
+// the script needs cmake (an unsupported command, a variable cmake may have defined, etc.). The
+// reason is logged in verbose mode.
+maybe<vector<string>> evaluate_deps_script_natively(
+    string_par deps_script_file,
+    const std::map<string, string>& cmake_cache_vars);
+
+// False if the script can't leave anything behind for the scripts included after it in the same
+// cmake process: it uses only commands which set normal variables in its own scope (and add_pkg,
+// def_pkg, message, flow control). Functions, macros, cache, parent-scope and environment
+// variables, included files, etc.. make it true, as does a script which can't be parsed.
+bool deps_script_may_affect_later_scripts(string_par deps_script_file);
+
+// True if the result of the script (or of a file included by a script) may depend on more than
+// the text of the files and the cmake cache: it reads environment variables, probes the file
+// system (if(EXISTS ...), include(... OPTIONAL), file(), find_*) or runs processes. Also true if
+// the script can't be parsed.
+bool deps_script_may_depend_on_environment(string_par deps_script_file);
+}
+
+#endif
@@ -1,17 +1,35 @@
 #include "git.h"
 
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <mutex>
 
 #include <nowide/cstdio.hpp>
 
+#include <Poco/Process.h>
+
 #include <adasworks/sx/check.h>
 #include <adasworks/sx/mutex.h>
 
+#include "cereal_utils.h"
 #include "filesystem.h"
+#include "git_refs.h"
 #include "misc_utils.h"
 #include "print.h"
 #include "cmakex_utils.h"
 
+namespace cmakex {
+struct ls_remote_disk_cache_entry_t
+{
+    string url;
+    int64_t time = 0;  // seconds since epoch
+    std::map<string, string> refs;
+};
+}
+
+CEREAL_CLASS_VERSION(cmakex::ls_remote_disk_cache_entry_t, 1)
+
 namespace cmakex {
 using adasworks::sx::atomic_flag_mutex;
 using lock_guard = std::lock_guard<atomic_flag_mutex>;
@@ -20,8 +38,30 @@ namespace fs = filesystem;
 namespace {
 atomic_flag_mutex s_git_executable_mutex;
 string s_git_executable;
+
+atomic_flag_mutex s_ls_remote_mutex;
+std::map<string, ls_remote_result_t> s_ls_remote_memo;  // url -> result
+string s_ls_remote_disk_cache_dir;                      // empty if disabled
+int s_ls_remote_disk_cache_ttl = 0;
+
+std::mutex s_git_mirror_mutex;
+std::condition_variable s_git_mirror_cv;
+string s_git_mirror_dir;  // empty if disabled
+// url -> mirror path (empty if not available), nothing while it's being created or updated
+std::map<string, maybe<string>> s_git_mirrors;
+}
+
+#define A(X) cereal::make_nvp(#X, m.X)
+
+template <class Archive>
+void serialize(Archive& archive, ls_remote_disk_cache_entry_t& m, uint32_t version)
+{
+    THROW_UNLESS(version == 1);
+    archive(A(url), A(time), A(refs));
 }
 
+#undef A
+
 string find_git_with_cmake()
 {
     string resolved_path;
@@ -58,7 +98,7 @@ string find_git_with_cmake()
         for (int i = 0; i < oem.size(); ++i) {
             auto msg = oem.at(i);
             if (msg.source == out_err_message_base_t::source_stderr) {
-                resolved_path = strip_trailing_whitespace(msg.text);
+                resolved_path = strip_trailing_whitespace(msg.str());
                 break;
             }
         }
@@ -88,11 +128,9 @@ void test_git(string_par git_command)
         throwf("Can't find git. Error code: %d, PATH: %s", r, p ? p : "<null>");
     } else {
         if (oem.size() >= 1) {
-            auto msg = oem.at(0);
-            auto pos = std::min(msg.text.find('\n'), msg.text.find('\r'));
-            if (pos != string::npos)
-                msg.text = msg.text.substr(0, pos);
-            printf("%s\n", msg.text.c_str());
+            auto lines = split_lines(oem.at(0).text);
+            if (!lines.empty())
+                printf("%.*s\n", (int)lines[0].size(), lines[0].data());
         }
     }
 }
@@ -158,8 +196,8 @@ int exec_git(const vector<string>& args,
         OutErrMessages oem(oeb.move_result());
         for (int i = 0; i < oem.size(); ++i) {
             auto m = oem.at(i);
-            fprintf(m.source == out_err_message_base_t::source_stdout ? stdout : stderr, "%s\n",
-                    m.text.c_str());
+            fprintf(m.source == out_err_message_base_t::source_stdout ? stdout : stderr,
+                    "%.*s\n", (int)m.text.size(), m.text.data());
         }
     }
 
@@ -172,15 +210,39 @@ string first_line(const OutErrMessages& oem, out_err_message_base_t::source_t so
     for (int i = 0; i < oem.size(); ++i) {
         auto msg = oem.at(i);
         if (msg.source == source) {
-            s = msg.text;
+            s = msg.str();
             break;
         }
     }
     return s;
 }
 
+// `git ls-remote <url> <pattern>` lists the refs which are equal to the pattern or end with
+// '/<pattern>'
+bool ls_remote_pattern_matches(string_par ref, string_par pattern)
+{
+    return ref.str() == pattern.str() || ends_with(ref, "/" + pattern.str());
+}
+
 tuple<int, string> git_ls_remote(string_par url, string_par ref)
 {
+    // match the ref on the memoized full listing, except for the patterns we don't emulate
+    if (!ref.empty() && ref.str().find_first_of("*?[") == string::npos) {
+        maybe<ls_remote_result_t> lsr;
+        try {
+            lsr = git_ls_remote(url);
+        } catch (...) {
+            // fall through to the direct query which reports the error code
+        }
+        if (lsr) {
+            for (auto& kv : lsr->refs) {
+                if (ls_remote_pattern_matches(kv.first, ref))
+                    return make_tuple(0, kv.second);
+            }
+            return make_tuple(2, string{});  // same as ls-remote --exit-code
+        }
+    }
+
     vector<string> args = {"ls-remote", "--exit-code", url.c_str(), ref.c_str()};
     OutErrMessagesBuilder oeb(pipe_capture, pipe_echo);
     int r = exec_git(args, oeb.stdout_callback(), nullptr, log_git_command_never);
@@ -197,6 +259,9 @@ tuple<int, string> git_ls_remote(string_par url, string_par ref)
 
 string git_rev_parse(string_par ref, string_par dir)
 {
+    auto sha = git_rev_parse_natively(ref, dir);
+    if (sha)
+        return move(*sha);
     vector<string> args = {"rev-parse", ref.c_str()};
     OutErrMessagesBuilder oeb(pipe_capture, pipe_echo);
     if (exec_git(args, dir, oeb.stdout_callback(), nullptr, log_git_command_on_error))
@@ -220,40 +285,16 @@ int git_checkout(vector<string> args, string_par dir)
 }
 string try_find_unique_ref_by_sha_with_ls_remote(string_par git_url, string_par sha)
 {
-    OutErrMessagesBuilder oeb(pipe_capture, pipe_echo);
-    int r = exec_git({"ls-remote", git_url.c_str()}, oeb.stdout_callback(), nullptr,
-                     log_git_command_never);
-    if (r)
+    ls_remote_result_t lsr;
+    try {
+        lsr = git_ls_remote(git_url);
+    } catch (...) {
         return {};
-    auto oem = oeb.move_result();
+    }
     vector<string> results;
-    for (int i = 0; i < oem.size(); ++i) {
-        auto msg = oem.at(i);
-        if (msg.source != out_err_message_base_t::source_stdout || !istarts_with(msg.text, sha))
-            continue;
-        int j = 0;
-        int x0 = -1, x1 = -1;
-        while (j < msg.text.size()) {
-            if (iswspace(msg.text[j])) {
-                x0 = j + 1;
-                break;
-            }
-        }
-        if (x0 < 0)
-            throwf("Invalid line in the output of git-ls-remote, no whitespace: %s",
-                   msg.text.c_str());
-        j = x0;
-        x1 = msg.text.size();
-        while (j < msg.text.size()) {
-            if (iswspace(msg.text[j])) {
-                x1 = j;
-                break;
-            }
-        }
-        if (x1 == x0)
-            throwf("Invalid line in the output of git-ls-remote, no word after whitespace: %s",
-                   msg.text.c_str());
-        results.emplace_back(msg.text.substr(x0, x1 - x0));
+    for (auto& kv : lsr.refs) {
+        if (istarts_with(kv.second, sha))
+            results.emplace_back(kv.first);
     }
     if (results.empty())
         return {};
@@ -319,12 +360,14 @@ bool git_status_result_t::clean_or_untracked_only() const
     return true;
 }
 
-git_status_result_t git_status(string_par dir, bool branch_tracking)
+git_status_result_t git_status(string_par dir, bool branch_tracking, bool untracked_files)
 {
     OutErrMessagesBuilder oeb(pipe_capture, pipe_echo);
     vector<string> args = {"status", "-s", "--porcelain"};
     if (branch_tracking)
         args.push_back("-b");
+    if (!untracked_files)
+        args.push_back("--untracked-files=no");
 
     int r = exec_git(args, dir, oeb.stdout_callback(), nullptr, log_git_command_on_error);
     if (r)
@@ -336,10 +379,9 @@ git_status_result_t git_status(string_par dir, bool branch_tracking)
         auto msg = oem.at(i);
         if (msg.source != out_err_message_base_t::source_stdout)
             continue;
-        auto lines = split_at_newlines(msg.text);
-        for (auto& l : lines) {
+        for (auto l : split_lines(msg.text)) {
             if (l.size() >= 4)
-                result.lines.emplace_back(move(l));
+                result.lines.emplace_back(make_string(l));
         }
     }
     return result;
@@ -356,9 +398,90 @@ string ls_remote_result_t::head_branch() const
     // never here
 }
 
-ls_remote_result_t git_ls_remote(string_par url)
+void enable_ls_remote_disk_cache(string_par dir, int ttl_seconds)
+{
+    lock_guard lock(s_ls_remote_mutex);
+    s_ls_remote_disk_cache_dir = dir.str();
+    s_ls_remote_disk_cache_ttl = ttl_seconds;
+}
+
+int64_t seconds_since_epoch()
+{
+    return std::chrono::duration_cast<std::chrono::seconds>(
+               std::chrono::system_clock::now().time_since_epoch())
+        .count();
+}
+
+// must be called with s_ls_remote_mutex locked
+string ls_remote_disk_cache_path(string_par url)
+{
+    return stringf("%s/%s.json", s_ls_remote_disk_cache_dir.c_str(), string_sha(url.str()).c_str());
+}
+
+void fill_ls_remote_result_from_refs(ls_remote_result_t& result)
 {
+    for (auto& kv : result.refs) {
+        auto& ref = kv.first;
+        auto& sha = kv.second;
+        if (ref == "HEAD")
+            result.head_sha = sha;
+        else if (starts_with(ref, "refs/heads/")) {
+            string branch = make_string(butleft(ref, strlen("refs/heads/")));
+            result.branches[branch] = sha;
+        } else if (starts_with(ref, "refs/tags/")) {
+            string tag = make_string(butleft(ref, strlen("refs/tags/")));
+            result.tags[tag] = sha;
+        }
+    }
+}
+
+// must be called with s_ls_remote_mutex locked
+maybe<ls_remote_result_t> try_load_ls_remote_from_disk_cache(string_par url)
+{
+    if (s_ls_remote_disk_cache_dir.empty())
+        return {};
+    auto path = ls_remote_disk_cache_path(url);
+    if (!fs::is_regular_file(path))
+        return {};
+    ls_remote_disk_cache_entry_t e;
+    try {
+        load_json_input_archive(path, e);
+    } catch (const exception& ex) {
+        log_warn("Ignoring invalid ls-remote cache file, reason: %s", ex.what());
+        return {};
+    }
+    auto age = seconds_since_epoch() - e.time;
+    if (e.url != url.str() || age < 0 || age >= s_ls_remote_disk_cache_ttl)
+        return {};
+    log_verbose("Using cached ls-remote result of %s (%d seconds old)", url.c_str(), (int)age);
     ls_remote_result_t result;
+    result.url = url.str();
+    result.refs = move(e.refs);
+    fill_ls_remote_result_from_refs(result);
+    return result;
+}
+
+// must be called with s_ls_remote_mutex locked
+void save_ls_remote_to_disk_cache(const ls_remote_result_t& x)
+{
+    if (s_ls_remote_disk_cache_dir.empty())
+        return;
+    ls_remote_disk_cache_entry_t e;
+    e.url = x.url;
+    e.time = seconds_since_epoch();
+    e.refs = x.refs;
+    try {
+        fs::create_directories(s_ls_remote_disk_cache_dir);
+        save_json_output_archive(ls_remote_disk_cache_path(x.url), e);
+    } catch (const exception& ex) {
+        log_warn("Can't write ls-remote cache file, reason: %s", ex.what());
+    }
+}
+
+ls_remote_result_t git_ls_remote_uncached(string_par url)
+{
+    ls_remote_result_t result;
+    result.url = url.str();
 
     vector<string> args = {"ls-remote", "--exit-code", url.c_str()};
     OutErrMessagesBuilder oeb(pipe_capture, pipe_echo);
@@ -370,9 +493,8 @@ ls_remote_result_t git_ls_remote(string_par url)
         auto s = oem.at(i);
         if (s.source != out_err_message_base_t::source_stdout)
             continue;
-        auto v = split_at_newlines(s.text);
-        for (auto& wx : v) {
-            string x = trim(wx);
+        for (auto wx : split_lines(s.text)) {
+            string x = trim(make_string(wx));
             if (x.empty())
                 continue;
             string sha, ref;
@@ -391,22 +513,116 @@ ls_remote_result_t git_ls_remote(string_par url)
             if (!sha_like(sha))
                 throwf("Invalid line from 'git ls-remote %s', invalid SHA in: \"%s\"", url.c_str(),
                        x.c_str());
-            if (ref == "HEAD")
-                result.head_sha = sha;
-            else if (starts_with(ref, "refs/heads/")) {
-                string branch = make_string(butleft(ref, strlen("refs/heads/")));
-                result.branches[branch] = sha;
-            } else if (starts_with(ref, "refs/tags/")) {
-                string tag = make_string(butleft(ref, strlen("refs/tags/")));
-                result.tags[tag] = sha;
+            result.refs[ref] = sha;
+        }
+    }
+    fill_ls_remote_result_from_refs(result);
+    return result;
+}
+
+ls_remote_result_t git_ls_remote(string_par url)
+{
+    {
+        lock_guard lock(s_ls_remote_mutex);
+        auto it = s_ls_remote_memo.find(url.str());
+        if (it != s_ls_remote_memo.end())
+            return it->second;
+        auto r = try_load_ls_remote_from_disk_cache(url);
+        if (r)
+            return s_ls_remote_memo[url.str()] = move(*r);
+    }
+    // not holding the lock while querying the remote
+    auto r = git_ls_remote_uncached(url);
+    lock_guard lock(s_ls_remote_mutex);
+    save_ls_remote_to_disk_cache(r);
+    return s_ls_remote_memo[url.str()] = move(r);
+}
+
+void enable_git_mirrors(string_par dir)
+{
+    std::lock_guard<std::mutex> lock(s_git_mirror_mutex);
+    s_git_mirror_dir = dir.str();
+}
+
+string git_mirror_of_url(string_par url)
+{
+    string mirror_dir;
+    {
+        std::unique_lock<std::mutex> lock(s_git_mirror_mutex);
+        if (s_git_mirror_dir.empty())
+            return {};
+        s_git_mirror_cv.wait(lock, [&url]() {
+            auto it = s_git_mirrors.find(url.str());
+            return it == s_git_mirrors.end() || it->second;
+        });
+        auto it = s_git_mirrors.find(url.str());
+        if (it != s_git_mirrors.end())
+            return *it->second;
+        s_git_mirrors[url.str()];  // mark as being processed
+        mirror_dir = stringf("%s/%s.git", s_git_mirror_dir.c_str(), string_sha(url.str()).c_str());
+    }
+
+    // The clones borrow the objects of the mirror through alternates so the mirror must never
+    // drop an object: no gc (which would prune the objects of force-pushed or deleted branches)
+    // and no pruning of the refs on fetch.
+    const vector<std::pair<string, string>> c_mirror_config = {{"gc.auto", "0"},
+                                                               {"gc.pruneExpire", "never"}};
+    string result;
+    string tmp_dir = stringf("%s.tmp-%ld", mirror_dir.c_str(), (long)Poco::Process::id());
+    try {
+        if (fs::is_directory(mirror_dir)) {
+            // the mirrors created by earlier versions may not have the config yet
+            bool configured = true;
+            for (auto& kv : c_mirror_config) {
+                if (exec_git({"config", kv.first, kv.second}, mirror_dir, nullptr, nullptr,
+                             log_git_command_on_error) != 0)
+                    configured = false;
             }
+            if (!configured)
+                log_warn("Failed to configure the git mirror of %s, not using it", url.c_str());
+            else {
+                // a stale mirror is still a good reference, the clone fetches the rest from the
+                // remote
+                if (exec_git({"-c", "gc.auto=0", "fetch", "--quiet"}, mirror_dir, nullptr,
+                             nullptr, log_git_command_on_error) != 0)
+                    log_warn("Failed to update the git mirror of %s", url.c_str());
+                result = mirror_dir;
+            }
+        } else {
+            fs::create_directories(s_git_mirror_dir);
+            vector<string> args = {"--mirror", "--quiet"};
+            for (auto& kv : c_mirror_config) {
+                args.emplace_back("--config");
+                args.emplace_back(kv.first + "=" + kv.second);
+            }
+            args.insert(args.end(), {url.c_str(), tmp_dir});
+            git_clone(args);
+            fs::rename(tmp_dir, mirror_dir);
+            result = mirror_dir;
         }
+    } catch (const exception& e) {
+        log_warn("Can't create the git mirror of %s, reason: %s", url.c_str(), e.what());
+        if (fs::is_directory(mirror_dir))  // created by another cmakex process meanwhile
+            result = mirror_dir;
     }
+    if (fs::exists(tmp_dir)) {
+        try {
+            fs::remove_all(tmp_dir);
+        } catch (...) {
+        }
+    }
+
+    std::lock_guard<std::mutex> lock(s_git_mirror_mutex);
+    s_git_mirrors[url.str()] = just(result);
+    s_git_mirror_cv.notify_all();
     return result;
 }
 
 bool git_is_existing_commit(string_par clone_dir, string_par ref)
 {
+    auto exists = git_is_existing_commit_natively(clone_dir, ref);
+    if (exists)
+        return *exists;
     OutErrMessagesBuilder oeb(pipe_capture, pipe_capture);
     return exec_git({"cat-file", "-e", (ref.str() + "^{commit}").c_str()}, clone_dir,
                     oeb.stdout_callback(), oeb.stderr_callback(), log_git_command_never) == 0;
@@ -414,6 +630,9 @@ bool git_is_existing_commit(string_par clone_dir, string_par ref)
 
 string git_current_branch_or_HEAD(string_par clone_dir)
 {
+    auto branch = git_current_branch_or_HEAD_natively(clone_dir);
+    if (branch)
+        return move(*branch);
     OutErrMessagesBuilder oeb(pipe_capture, pipe_echo);
     int r = exec_git({"rev-parse", "--abbrev-ref", "--verify", "-q", "HEAD"}, clone_dir,
                      oeb.stdout_callback(), nullptr, log_git_command_on_error);
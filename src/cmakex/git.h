@@ -11,6 +11,8 @@ namespace cmakex {
 // special SHA value to indicate uncommited changes
 // when comparing SHA's this should be evaluted as different from every SHA string even from itself
 static const char* const k_sha_uncommitted = "<uncommitted>";
+// the git_sha of an installed config built from uncommitted changes starts with this
+static const char* const k_installed_from_uncommitted_prefix = "<installed-from-uncommited-changes";
 
 // find git with cmake's find_package(Git), on failure returns "git"
 string find_git_or_return_git();
@@ -79,7 +81,9 @@ struct git_status_result_t
     vector<string> lines;
     bool clean_or_untracked_only() const;
 };
-git_status_result_t git_status(string_par dir, bool branch_tracking = false);
+git_status_result_t git_status(string_par dir,
+                               bool branch_tracking = false,
+                               bool untracked_files = true);
 
 // full ls-remote returning SHA - ref table
 struct ls_remote_result_t
@@ -90,9 +94,27 @@ struct ls_remote_result_t
     std::map<string, string> branches;  // branch -> SHA
     std::map<string, string> tags;      // tag -> SHA
     string head_sha;
+    std::map<string, string> refs;  // all refs as listed (HEAD, refs/heads/x, etc..) -> SHA
 };
 
+// The full ls-remote result is memoized per URL for the current run. The ls-remote functions
+// above also use it. Throws on error.
 ls_remote_result_t git_ls_remote(string_par url);
+
+// Enables the on-disk cache of the ls-remote results in `dir`. The entries younger than
+// `ttl_seconds` are used instead of querying the remote.
+void enable_ls_remote_disk_cache(string_par dir, int ttl_seconds);
+
+// Enables the shared store of bare mirrors in `dir`, one per URL, which the clones use through
+// `--reference` (alternates) so the objects are downloaded and stored only once for all the build
+// directories. The clones depend on the mirrors: the store must not be removed. The mirrors are
+// configured to never drop objects (no gc, no pruning on fetch).
+void enable_git_mirrors(string_par dir);
+
+// Creates the mirror of the URL or updates it, once per run. Returns its path or empty if mirrors
+// are not enabled or the mirror is not available (logs a warning). Thread-safe.
+string git_mirror_of_url(string_par url);
+
 string git_current_branch_or_HEAD(string_par clone_dir);
 bool git_is_existing_commit(string_par clone_dir, string_par ref);
 }
@@ -0,0 +1,392 @@
+#include "git_refs.h"
+
+#include <cctype>
+#include <iterator>
+
+#ifndef _WIN32
+#include <sys/stat.h>
+#endif
+
+#include <nowide/fstream.hpp>
+
+#include <Poco/File.h>
+#include <Poco/InflatingStream.h>
+
+#include "filesystem.h"
+#include "git.h"
+#include "misc_utils.h"
+
+namespace cmakex {
+
+namespace fs = filesystem;
+
+namespace {
+struct git_dirs_t
+{
+    string git_dir;     // HEAD and the other per-worktree files
+    string common_dir;  // refs, packed-refs and objects
+};
+
+// the result of looking up a ref: nothing if it can't be decided, empty string if it doesn't exist
+using ref_lookup_t = maybe<string>;
+
+bool hex_sha(string_par x)
+{
+    if (x.size() != 40 && x.size() != 64)  // SHA-1 or SHA-256
+        return false;
+    for (const char* c = x.c_str(); *c; ++c)
+        if (!isxdigit(*c))
+            return false;
+    return true;
+}
+
+// plain ref names only, anything git would parse as an expression is left for git
+bool plain_ref_name(string_par x)
+{
+    if (x.empty() || x[0] == '-' || x[0] == '.' || x[0] == '/' || ends_with(x, "/") ||
+        ends_with(x, ".lock") || strstr(x.c_str(), "..") || strstr(x.c_str(), "//"))
+        return false;
+    for (const char* c = x.c_str(); *c; ++c)
+        if (!isalnum(*c) && !strchr("._/-", *c))
+            return false;
+    return true;
+}
+
+string first_line_of_file(string_par path)
+{
+    auto lines = must_read_file_as_lines(path);
+    return lines.empty() ? string() : trim(lines[0]);
+}
+
+string path_relative_to(string_par path, string_par base_dir)
+{
+    if (fs::path(path.c_str()).is_absolute())
+        return path.str();
+    return fs::lexically_normal(base_dir.str() + "/" + path.str()).string();
+}
+
+maybe<git_dirs_t> find_git_dirs(string_par work_tree)
+{
+    git_dirs_t r;
+    string dotgit = work_tree.str() + "/.git";
+    if (fs::is_directory(dotgit)) {
+        r.git_dir = dotgit;
+    } else if (fs::is_regular_file(dotgit)) {
+        // worktrees and submodules: "gitdir: <path>"
+        auto l = first_line_of_file(dotgit);
+        if (!starts_with(l, "gitdir: "))
+            return {};
+        r.git_dir = path_relative_to(trim(l.substr(strlen("gitdir: "))), work_tree);
+        if (!fs::is_directory(r.git_dir))
+            return {};
+    } else
+        return {};  // git would look in the parent directories
+    string commondir_file = r.git_dir + "/commondir";
+    r.common_dir = fs::is_regular_file(commondir_file)
+                       ? path_relative_to(first_line_of_file(commondir_file), r.git_dir)
+                       : r.git_dir;
+    if (fs::exists(r.common_dir + "/reftable") || !fs::is_regular_file(r.git_dir + "/HEAD"))
+        return {};
+    return just(r);
+}
+
+// finds a ref in packed-refs, the SHA it points to or empty string
+string find_packed_ref(const git_dirs_t& d, string_par ref)
+{
+    string path = d.common_dir + "/packed-refs";
+    if (!fs::is_regular_file(path))
+        return {};
+    for (auto& l : must_read_file_as_lines(path)) {
+        if (l.empty() || l[0] == '#' || l[0] == '^')
+            continue;
+        auto sp = l.find(' ');
+        if (sp != string::npos && l.compare(sp + 1, string::npos, ref.str()) == 0)
+            return l.substr(0, sp);
+    }
+    return {};
+}
+
+ref_lookup_t resolve_ref(const git_dirs_t& d, string_par ref, int depth = 0)
+{
+    if (depth > 5 || !plain_ref_name(ref))
+        return {};
+    // the per-worktree refs are not in the common dir
+    if (ref.str() != "HEAD" && !starts_with(ref, "refs/"))
+        return {};
+    if (starts_with(ref, "refs/bisect/") || starts_with(ref, "refs/worktree/") ||
+        starts_with(ref, "refs/rewritten/"))
+        return {};
+    string loose = (ref.str() == "HEAD" ? d.git_dir : d.common_dir) + "/" + ref.str();
+    if (fs::is_directory(loose))
+        return just(string());
+    if (fs::is_regular_file(loose)) {
+        auto l = first_line_of_file(loose);
+        if (starts_with(l, "ref: "))
+            return resolve_ref(d, trim(l.substr(strlen("ref: "))), depth + 1);
+        if (hex_sha(l))
+            return just(l);
+        return {};
+    }
+    if (ref.str() == "HEAD")
+        return {};
+    auto sha = find_packed_ref(d, ref);
+    return just(sha);
+}
+
+// true if `name` may be resolved to something by any of the dwim rules other than `except`
+bool any_ref_matches(const git_dirs_t& d, string_par name, string_par except)
+{
+    if (fs::exists(d.git_dir + "/" + name.str()))
+        return true;
+    for (auto& f : {"refs/%s", "refs/tags/%s", "refs/heads/%s", "refs/remotes/%s",
+                    "refs/remotes/%s/HEAD"}) {
+        string ref = stringf(f, name.c_str());
+        if (ref == except.str())
+            continue;
+        auto r = resolve_ref(d, ref);
+        if (!r || !r->empty())
+            return true;
+    }
+    return false;
+}
+
+// type of a loose object or empty string if it's not a loose object
+string loose_object_type(const git_dirs_t& d, string_par sha)
+{
+    vector<string> object_dirs{d.common_dir + "/objects"};
+    string alternates = d.common_dir + "/objects/info/alternates";
+    if (fs::is_regular_file(alternates)) {
+        for (auto& l : must_read_file_as_lines(alternates)) {
+            auto a = trim(l);
+            if (!a.empty() && a[0] != '#')
+                object_dirs.emplace_back(path_relative_to(a, object_dirs.front()));
+        }
+    }
+    string lower_sha = tolower(sha.str());
+    for (auto& od : object_dirs) {
+        string path =
+            stringf("%s/%s/%s", od.c_str(), lower_sha.substr(0, 2).c_str(), lower_sha.c_str() + 2);
+        if (!fs::is_regular_file(path))
+            continue;
+        // the header is "<type> <size>\0"
+        nowide::ifstream f(path.c_str(), std::ios_base::in | std::ios_base::binary);
+        Poco::InflatingInputStream inflater(f, Poco::InflatingStreamBuf::STREAM_ZLIB);
+        string type;
+        char c;
+        while (type.size() < 16 && inflater.get(c) && c != ' ')
+            type += c;
+        return type;
+    }
+    return {};
+}
+
+uint32_t be32(const string& data, size_t pos)
+{
+    auto p = reinterpret_cast<const unsigned char*>(data.data()) + pos;
+    return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | p[3];
+}
+
+uint16_t be16(const string& data, size_t pos)
+{
+    auto p = reinterpret_cast<const unsigned char*>(data.data()) + pos;
+    return uint16_t((p[0] << 8) | p[1]);
+}
+
+#ifndef _WIN32
+int64_t mtime_ns(const struct stat& st)
+{
+#ifdef __APPLE__
+    return int64_t(st.st_mtimespec.tv_sec) * 1000000000 + st.st_mtimespec.tv_nsec;
+#else
+    return int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+#endif
+}
+
+// compares the stat data of the entries of a version 2 or 3 index with the work tree
+bool index_entries_match_work_tree(const string& data,
+                                   string_par work_tree,
+                                   int64_t index_mtime_ns)
+{
+    const size_t k_header_size = 12, k_sha_size = 20;
+    const size_t k_stat_size = 40;  // ctime, mtime, dev, ino, mode, uid, gid, size
+    if (data.size() < k_header_size || data.compare(0, 4, "DIRC") != 0)
+        return false;
+    auto version = be32(data, 4);
+    if (version != 2 && version != 3)
+        return false;
+    auto n = be32(data, 8);
+    size_t pos = k_header_size;
+    for (uint32_t i = 0; i < n; ++i) {
+        size_t flags_pos = pos + k_stat_size + k_sha_size;
+        if (data.size() < flags_pos + 2)
+            return false;
+        auto flags = be16(data, flags_pos);
+        size_t path_pos = flags_pos + 2;
+        bool skip_worktree = false;
+        if (flags & 0x4000) {  // extended
+            if (version < 3 || data.size() < path_pos + 2)
+                return false;
+            auto ext_flags = be16(data, path_pos);
+            if (ext_flags & 0x2000)  // intent-to-add
+                return false;
+            skip_worktree = (ext_flags & 0x4000) != 0;
+            path_pos += 2;
+        }
+        auto path_end = data.find('\0', path_pos);
+        if (path_end == string::npos)
+            return false;
+        auto mode = be32(data, pos + 24);
+        if ((flags & 0x3000) != 0 || (mode & 0170000) == 0160000)  // conflict or submodule
+            return false;
+        if (!(flags & 0x8000) && !skip_worktree) {  // not assume-valid
+            string path = work_tree.str() + "/" + data.substr(path_pos, path_end - path_pos);
+            struct stat st;
+            if (lstat(path.c_str(), &st) != 0)
+                return false;
+            int64_t entry_mtime_ns =
+                int64_t(be32(data, pos + 8)) * 1000000000 + be32(data, pos + 12);
+            if (mtime_ns(st) != entry_mtime_ns || uint32_t(st.st_size) != be32(data, pos + 36) ||
+                uint32_t(st.st_ino) != be32(data, pos + 20) ||
+                uint32_t(st.st_ctime) != be32(data, pos))
+                return false;
+            // racy: it may have been modified after the index was written in the same second
+            if (entry_mtime_ns / 1000000000 >= index_mtime_ns / 1000000000)
+                return false;
+        }
+        // entries are padded with 1-8 NULs to a multiple of 8 bytes
+        pos += (path_end - pos + 8) & ~size_t(7);
+    }
+    // the entries of a split index are in another file
+    return data.size() < pos + 4 || data.compare(pos, 4, "link") != 0;
+}
+#endif
+}
+
+maybe<string> git_rev_parse_natively(string_par ref, string_par work_tree)
+{
+    try {
+        auto d = find_git_dirs(work_tree);
+        if (!d || !plain_ref_name(ref))
+            return {};
+        if (ref.str() == "HEAD")
+            return resolve_ref(*d, "HEAD");
+        // SHAs and their prefixes need the object database
+        if (sha_like(ref) || hex_sha(ref))
+            return {};
+        // the dwim rules of git, in order, the first one is the ref itself
+        if (starts_with(ref, "refs/")) {
+            auto r = resolve_ref(*d, ref);
+            if (!r || !r->empty())
+                return r;
+        } else if (fs::exists(d->git_dir + "/" + ref.str()))
+            return {};  // FETCH_HEAD, ORIG_HEAD, etc.
+        for (auto& f : {"refs/%s", "refs/tags/%s", "refs/heads/%s", "refs/remotes/%s",
+                        "refs/remotes/%s/HEAD"}) {
+            auto r = resolve_ref(*d, stringf(f, ref.c_str()));
+            if (!r || !r->empty())
+                return r;
+        }
+        return just(string());
+    } catch (...) {
+        return {};
+    }
+}
+
+maybe<string> git_current_branch_or_HEAD_natively(string_par work_tree)
+{
+    try {
+        auto d = find_git_dirs(work_tree);
+        if (!d)
+            return {};
+        auto head = first_line_of_file(d->git_dir + "/HEAD");
+        if (hex_sha(head))
+            return just(string("HEAD"));
+        const char* prefix = "ref: refs/heads/";
+        if (!starts_with(head, prefix))
+            return {};
+        string ref = trim(head.substr(strlen("ref: ")));
+        auto sha = resolve_ref(*d, ref);
+        if (!sha || sha->empty())
+            return {};  // unborn branch, git fails
+        // git abbreviates to 'heads/<branch>' if the branch name is ambiguous
+        string branch = head.substr(strlen(prefix));
+        if (any_ref_matches(*d, branch, ref))
+            return {};
+        return just(branch);
+    } catch (...) {
+        return {};
+    }
+}
+
+maybe<bool> git_is_existing_commit_natively(string_par work_tree, string_par ref)
+{
+    try {
+        auto d = find_git_dirs(work_tree);
+        if (!d)
+            return {};
+        if (starts_with(ref, "refs/heads/") || starts_with(ref, "refs/remotes/")) {
+            auto sha = resolve_ref(*d, ref);
+            if (!sha)
+                return {};
+            return just(!sha->empty());  // branches point to commits
+        }
+        if (hex_sha(ref)) {
+            auto type = loose_object_type(*d, ref);
+            // not loose: it may be in a pack, annotated tag: git peels it
+            if (type.empty() || type == "tag")
+                return {};
+            return just(type == "commit");
+        }
+        return {};
+    } catch (...) {
+        return {};
+    }
+}
+
+string git_index_stamp(string_par work_tree)
+{
+    try {
+        auto d = find_git_dirs(work_tree);
+        if (!d)
+            return {};
+        Poco::File f(d->git_dir + "/index");
+        if (!f.exists())
+            return {};
+        return stringf("%lld %lld", (long long)f.getSize(),
+                       (long long)f.getLastModified().epochMicroseconds());
+    } catch (...) {
+        return {};
+    }
+}
+
+bool git_work_tree_matches_index(string_par work_tree)
+{
+#ifdef _WIN32
+    // the index stores different stat data on Windows
+    return false;
+#else
+    try {
+        auto d = find_git_dirs(work_tree);
+        if (!d)
+            return false;
+        auto config = d->common_dir + "/config";
+        if (fs::is_regular_file(config)) {
+            for (auto& l : must_read_file_as_lines(config)) {
+                // SHA-256 repositories
+                if (tolower(l).find("objectformat") != string::npos)
+                    return false;
+            }
+        }
+        string index_path = d->git_dir + "/index";
+        struct stat st;
+        if (stat(index_path.c_str(), &st) != 0)
+            return false;
+        nowide::ifstream f(index_path.c_str(), std::ios_base::in | std::ios_base::binary);
+        string data{std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>()};
+        return index_entries_match_work_tree(data, work_tree, mtime_ns(st));
+    } catch (...) {
+        return false;
+    }
+#endif
+}
+}
@@ -0,0 +1,33 @@
+#ifndef GIT_REFS_2938471029
+#define GIT_REFS_2938471029
+
+#include "using-decls.h"
+
+namespace cmakex {
+
+// In-process readers of a local repository: HEAD, the loose refs, packed-refs, the .git files of
+// worktrees and submodules, the loose objects and the index. They answer the common queries without
+// launching git and return nothing when they can't be sure of the answer (the directory has no
+// .git entry of its own, the repository uses reftable, the ref is not a plain name, the object is
+// packed, etc.), the callers must run git then.
+
+// same as `git rev-parse <ref>`: the SHA or empty string if the ref doesn't exist
+maybe<string> git_rev_parse_natively(string_par ref, string_par work_tree);
+
+// same as `git rev-parse --abbrev-ref HEAD`: the current branch or "HEAD" if detached
+maybe<string> git_current_branch_or_HEAD_natively(string_par work_tree);
+
+// same as `git cat-file -e <ref>^{commit}`, handles branches and full SHAs
+maybe<bool> git_is_existing_commit_natively(string_par work_tree, string_par ref);
+
+// size and modification time of the index file, empty string if it can't be found
+string git_index_stamp(string_par work_tree);
+
+// true if the stat data of each tracked file is the same as recorded in the index and none of them
+// is racy (modified in the same second the index was written), so `git status` would find no
+// changes between the index and the work tree. False if they differ or if it can't be told
+// (index version 4, split index, submodules, conflicts, etc.)
+bool git_work_tree_matches_index(string_par work_tree);
+}
+
+#endif
@@ -1,21 +1,55 @@
 #include "helper_cmake_project.h"
 
 #include <nowide/cstdio.hpp>
+#include <nowide/cstdlib.hpp>
 
+#include "cereal_utils.h"
 #include "cmakex-types.h"
 #include "cmakex_utils.h"
+#include "deps_script_evaluator.h"
 #include "filesystem.h"
+#include "log_writer.h"
 #include "misc_utils.h"
-#include "out_err_messages.h"
 #include "print.h"
 #include "resource.h"
+#include "run_fingerprint.h"
+
+namespace cmakex {
+// The result of a deps script evaluation along with everything it depends on. It's valid while
+// the SHAs of the script and of the files it included (local and downloaded ones) and the cmake
+// args of the wrapper project are the same. Scripts which may depend on anything else are not
+// cached (see deps_script_may_depend_on_environment).
+struct deps_script_cache_t
+{
+    string deps_script_file;
+    string cmake_args_sha;  // includes the wrapper project's version
+    std::map<string, string> file_shas;  // SHA of each included file, the deps script, too
+    vector<string> add_pkg_lines;
+};
+}
+
+CEREAL_CLASS_VERSION(cmakex::deps_script_cache_t, 1)
 
 namespace cmakex {
 
 namespace fs = filesystem;
 
+#define A(X) cereal::make_nvp(#X, m.X)
+
+template <class Archive>
+void serialize(Archive& archive, deps_script_cache_t& m, uint32_t version)
+{
+    THROW_UNLESS(version == 1);
+    archive(A(deps_script_file), A(cmake_args_sha), A(file_shas), A(add_pkg_lines));
+}
+
+#undef A
+
 static const char* const k_build_script_add_pkg_out_filename = "add_pkg_out.txt";
 static const char* const k_build_script_cmakex_out_filename = "cmakex_out.txt";
+static const char* const k_build_script_included_files_out_filename = "included_files_out.txt";
+static const char* const k_deps_script_cache_dirname = "deps_script_cache";
+static const char* const k_configure_stamp_filename = "cmakex_configure_stamp.txt";
 static const char* const k_default_binary_dirname = "b";
 static const char* const k_executor_project_command_cache_var = "__CMAKEX_EXECUTOR_PROJECT_COMMAND";
 // static const char* const k_build_script_executor_log_name = "deps_script_wrapper";
@@ -45,8 +79,144 @@ HelperCmakeProject::HelperCmakeProject(string_par binary_dir)
       build_script_executor_binary_dir(cfg.cmakex_executor_dir() + "/" + k_default_binary_dirname),
       build_script_add_pkg_out_file(cfg.cmakex_tmp_dir() + "/" +
                                     k_build_script_add_pkg_out_filename),
-      build_script_cmakex_out_file(cfg.cmakex_tmp_dir() + "/" + k_build_script_cmakex_out_filename)
+      build_script_cmakex_out_file(cfg.cmakex_tmp_dir() + "/" + k_build_script_cmakex_out_filename),
+      build_script_included_files_out_file(cfg.cmakex_tmp_dir() + "/" +
+                                           k_build_script_included_files_out_filename)
+{
+}
+
+namespace {
+string deps_script_cache_path(const cmakex_config_t& cfg, string_par deps_script_file)
+{
+    return stringf("%s/%s/%s.json", cfg.cmakex_dir().c_str(), k_deps_script_cache_dirname,
+                   string_sha(deps_script_file.str()).c_str());
+}
+
+string deps_script_cmake_args_sha(string_par executor_binary_dir)
+{
+    auto cct = load_cmake_cache_tracker(executor_binary_dir);
+    return string_sha(join(cct.cached_cmake_args, "\n") + "\n" + cct.c_sha + "\n" +
+                      cct.cmake_toolchain_file_sha + "\n" +
+                      deps_script_wrapper_cmakelists_checksum(deps_script_wrapper_cmakelists()));
+}
+
+// the file (the deps script or an included one) whose result may depend on the environment or
+// the file system
+maybe<string> find_file_depending_on_environment(const vector<string>& files)
+{
+    for (auto& f : files) {
+        if (deps_script_may_depend_on_environment(f))
+            return just(f);
+    }
+    return {};
+}
+
+maybe<vector<string>> try_get_deps_script_result_from_cache(const cmakex_config_t& cfg,
+                                                            string_par deps_script_file,
+                                                            string_par executor_binary_dir)
 {
+    auto path = deps_script_cache_path(cfg, deps_script_file);
+    if (!fs::is_regular_file(path))
+        return {};
+    try {
+        deps_script_cache_t c;
+        load_json_input_archive(path, c);
+        if (c.deps_script_file != deps_script_file.str() ||
+            c.cmake_args_sha != deps_script_cmake_args_sha(executor_binary_dir))
+            return {};
+        vector<string> files;
+        for (auto& kv : c.file_shas) {
+            if (!fs::is_regular_file(kv.first) || file_sha(kv.first) != kv.second)
+                return {};
+            files.emplace_back(kv.first);
+        }
+        if (find_file_depending_on_environment(files))
+            return {};
+        for (auto& f : files)
+            watch_file_for_run_fingerprint(f);
+        return just(move(c.add_pkg_lines));
+    } catch (const exception& e) {
+        log_warn("Ignoring the cached result of the dependency script, reason: %s", e.what());
+    }
+    return {};
+}
+
+// SHA of what the configuration of the wrapper project depends on, besides the cmake args (the
+// cmakex version is passed as -DCMAKEX_VERSION)
+string configure_stamp(string_par cmakelists_text_hash)
+{
+    string s = cmakelists_text_hash.str() + "\n" + cmake_version() + "\n" + cmakex_version_mmp +
+               "\n";
+    for (auto v : {"CC", "CXX", "CFLAGS", "CXXFLAGS", "LDFLAGS", "CMAKE_GENERATOR",
+                   "CMAKE_GENERATOR_PLATFORM", "CMAKE_GENERATOR_TOOLSET", "CMAKE_TOOLCHAIN_FILE"}) {
+        auto e = nowide::getenv(v);
+        s += stringf("%s%s%s\n", v, e ? "=" : "", e ? e : "");
+    }
+    return string_sha(s);
+}
+
+// the -C and toolchain files are inputs of the run fingerprint whether or not the configuration
+// is skipped
+void watch_cmake_arg_files(const vector<string>& args)
+{
+    for (auto& a : args) {
+        auto pca = parse_cmake_arg(a);
+        if (pca.switch_ == "-C" || (pca.switch_ == "-D" && pca.name == "CMAKE_TOOLCHAIN_FILE"))
+            watch_file_for_run_fingerprint(pca.value);
+    }
+}
+
+// true if the pending args have already been applied and the files they refer to are unchanged
+bool pending_cmake_args_already_applied(const cmake_cache_tracker_t& cct)
+{
+    if (normalize_cmake_args(concat(cct.cached_cmake_args, cct.pending_cmake_args)) !=
+        cct.cached_cmake_args)
+        return false;
+    for (auto& a : cct.pending_cmake_args) {
+        auto pca = parse_cmake_arg(a);
+        string sha;
+        if (pca.switch_ == "-C")
+            sha = cct.c_sha;
+        else if (pca.switch_ == "-D" && pca.name == "CMAKE_TOOLCHAIN_FILE")
+            sha = cct.cmake_toolchain_file_sha;
+        else
+            continue;
+        if (!fs::is_regular_file(pca.value) || file_sha(pca.value) != sha)
+            return false;
+    }
+    return true;
+}
+
+void save_deps_script_result_to_cache(const cmakex_config_t& cfg,
+                                      string_par deps_script_file,
+                                      string_par executor_binary_dir,
+                                      const vector<string>& included_files,
+                                      const vector<string>& add_pkg_lines)
+{
+    try {
+        auto f = find_file_depending_on_environment(
+            concat(vector<string>{deps_script_file.str()}, included_files));
+        if (f) {
+            log_verbose("The result of the dependency script is not cached, %s reads the "
+                        "environment or the file system.",
+                        path_for_log(*f).c_str());
+            return;
+        }
+        deps_script_cache_t c;
+        c.deps_script_file = deps_script_file.str();
+        c.cmake_args_sha = deps_script_cmake_args_sha(executor_binary_dir);
+        for (auto& f : included_files) {
+            c.file_shas[f] = file_sha(f);
+            watch_file_for_run_fingerprint(f);
+        }
+        c.add_pkg_lines = add_pkg_lines;
+        auto path = deps_script_cache_path(cfg, deps_script_file);
+        fs::create_directories(fs::path(path).parent_path());
+        save_json_output_archive(path, c);
+    } catch (const exception& e) {
+        log_warn("Can't cache the result of the dependency script, reason: %s", e.what());
+    }
+}
 }
 
 void HelperCmakeProject::configure(const vector<string>& command_line_cmake_args,
@@ -108,6 +278,23 @@ void HelperCmakeProject::configure(const vector<string>& command_line_cmake_args
 
     auto cct = load_cmake_cache_tracker(build_script_executor_binary_dir);
     cct.add_pending(command_line_cmake_args);
+    watch_cmake_arg_files(concat(cct.cached_cmake_args, cct.pending_cmake_args));
+
+    string cmake_cache_path = build_script_executor_binary_dir + "/CMakeCache.txt";
+    string stamp_path = build_script_executor_binary_dir + "/" + k_configure_stamp_filename;
+    string stamp = configure_stamp(cmakelists_text_hash);
+    if (!initial_config && cmakelists_exists && fs::is_regular_file(stamp_path) &&
+        pending_cmake_args_already_applied(cct)) {
+        auto lines = must_read_file_as_lines(stamp_path);
+        if (lines.size() == 1 && lines[0] == stamp) {
+            log_verbose("The helper project is up-to-date, skipping its configuration.");
+            cmake_cache = read_cmake_cache(cmake_cache_path);
+            return;
+        }
+    }
+    if (fs::exists(stamp_path))
+        fs::remove(stamp_path);
+
     save_cmake_cache_tracker(build_script_executor_binary_dir, cct);
 
     vector<string> args = cct.pending_cmake_args;
@@ -118,30 +305,25 @@ void HelperCmakeProject::configure(const vector<string>& command_line_cmake_args
 
     auto cl_config = string_exec("cmake", args);
 
-    OutErrMessagesBuilder oeb(pipe_capture, pipe_capture);
-    int r;
     string filename =
         stringf("%s-deps_script_wrapper-configure%s", pkg_name.c_str(), k_log_extension);
+    LogWriter log(cl_config, cfg.cmakex_log_dir(), filename, pipe_capture, pipe_capture);
+    int r;
     try {
-        r = exec_process("cmake", args, oeb.stdout_callback(), oeb.stderr_callback());
+        r = exec_process("cmake", args, log.stdout_callback(), log.stderr_callback());
     } catch (...) {
-        r = ECANCELED;
         fflush(stdout);
         printf("%s\n", cl_config.c_str());
-
-        save_log_from_oem(cl_config, r != EXIT_SUCCESS, oeb.move_result(), cfg.cmakex_log_dir(),
-                          filename);
+        log.finish(true);
         fflush(stdout);
         throw;
     }
-    auto oem = oeb.move_result();
 
     if (r)
         printf("%s\n", cl_config.c_str());
 
-    save_log_from_oem(cl_config, r != EXIT_SUCCESS, oem, cfg.cmakex_log_dir(), filename);
+    log.finish(r != EXIT_SUCCESS);
 
-    string cmake_cache_path = build_script_executor_binary_dir + "/CMakeCache.txt";
     if (r != EXIT_SUCCESS) {
         if (initial_config && fs::is_regular_file(cmake_cache_path))
             fs::remove(cmake_cache_path);
@@ -150,50 +332,174 @@ void HelperCmakeProject::configure(const vector<string>& command_line_cmake_args
 
     cct.confirm_pending();
     save_cmake_cache_tracker(build_script_executor_binary_dir, cct);
+    must_write_text(stamp_path, stamp + "\n");
 
     cmake_cache = read_cmake_cache(cmake_cache_path);
 }
 
-vector<string> HelperCmakeProject::run_deps_script(string_par deps_script_file,
-                                                   bool clear_downloaded_include_files,
-                                                   string_par pkg_name)
+vector<string> HelperCmakeProject::run_deps_script(
+    string_par deps_script_file,
+    bool clear_downloaded_include_files,
+    string_par pkg_name,
+    natively_evaluated_deps_scripts_t* natively_evaluated)
 {
+    if (natively_evaluated) {
+        auto it = natively_evaluated->find(deps_script_file.str());
+        if (it != natively_evaluated->end()) {
+            auto r = move(it->second);
+            natively_evaluated->erase(it);
+            // the package may have been checked out since
+            if (fs::is_regular_file(deps_script_file.c_str()) &&
+                file_sha(deps_script_file) == r.file_sha) {
+                watch_file_for_run_fingerprint(deps_script_file);
+                log_verbose("Evaluated the dependency script without cmake.");
+                return move(r.add_pkg_lines);
+            }
+        }
+    }
+
+    // most scripts can be evaluated without launching cmake
+    string cmake_cache_path = build_script_executor_binary_dir + "/CMakeCache.txt";
+    if (fs::is_regular_file(cmake_cache_path)) {
+        auto lines = evaluate_deps_script_natively(deps_script_file,
+                                                   read_whole_cmake_cache(cmake_cache_path).vars);
+        if (lines) {
+            watch_file_for_run_fingerprint(deps_script_file);
+            log_verbose("Evaluated the dependency script without cmake.");
+            return move(*lines);
+        }
+    }
+
+    // after clearing the downloaded include files the remote includes may have changed
+    if (!clear_downloaded_include_files) {
+        auto cached = try_get_deps_script_result_from_cache(cfg, deps_script_file,
+                                                            build_script_executor_binary_dir);
+        if (cached) {
+            log_verbose("Using the cached result of the dependency script.");
+            return move(*cached);
+        }
+    }
+
     test_cmake();
     vector<string> args;
     args.emplace_back(build_script_executor_binary_dir);
 
-    // create empty add_pkg out file
-    {
-        auto f = must_fopen(build_script_add_pkg_out_file.c_str(), "w");
-    }
+    // create empty add_pkg and included files out files
+    for (auto& p : {build_script_add_pkg_out_file, build_script_included_files_out_file})
+        must_fopen(p.c_str(), "w");
     args.emplace_back(string("-D") + k_executor_project_command_cache_var + "=run;" +
-                      deps_script_file.c_str() + ";" + build_script_add_pkg_out_file);
+                      deps_script_file.c_str() + ";" + build_script_add_pkg_out_file + ";" +
+                      build_script_included_files_out_file);
     if (clear_downloaded_include_files)
         args.emplace_back("-D__CMAKEX_INCL_CLEAR_DOWNLOAD_DIR=1");
 
     auto cl_deps = string_exec("cmake", args);
-    OutErrMessagesBuilder oeb2(pipe_capture, pipe_capture);
-    int r;
     string filename = stringf("%s-deps_script%s", pkg_name.c_str(), k_log_extension);
+    LogWriter log(cl_deps, cfg.cmakex_log_dir(), filename, pipe_capture, pipe_capture);
+    int r;
     try {
-        r = exec_process("cmake", args, oeb2.stdout_callback(), oeb2.stderr_callback());
+        r = exec_process("cmake", args, log.stdout_callback(), log.stderr_callback());
     } catch (...) {
-        r = ECANCELED;
         fflush(stdout);
         printf("%s\n", cl_deps.c_str());
-        save_log_from_oem(cl_deps, r != EXIT_SUCCESS, oeb2.move_result(), cfg.cmakex_log_dir(),
-                          filename);
+        log.finish(true);
         fflush(stdout);
         throw;
     }
-    auto oem2 = oeb2.move_result();
     if (r)
         printf("%s\n", cl_deps.c_str());
-    save_log_from_oem(cl_deps, r != EXIT_SUCCESS, oem2, cfg.cmakex_log_dir(), filename);
+    log.finish(r != EXIT_SUCCESS);
     if (r != EXIT_SUCCESS)
         throwf("Failed executing dependency script wrapper, result: %d.", r);
 
     // read the add_pkg_out
-    return must_read_file_as_lines(build_script_add_pkg_out_file);
+    auto add_pkg_lines = must_read_file_as_lines(build_script_add_pkg_out_file);
+    save_deps_script_result_to_cache(cfg, deps_script_file, build_script_executor_binary_dir,
+                                     must_read_file_as_lines(build_script_included_files_out_file),
+                                     add_pkg_lines);
+    return add_pkg_lines;
+}
+
+int HelperCmakeProject::run_deps_scripts_in_batch(
+    const vector<pair_ss>& pkgs_and_scripts,
+    natively_evaluated_deps_scripts_t& natively_evaluated)
+{
+    struct item_t
+    {
+        string deps_script_file, add_pkg_out_file, included_files_out_file;
+    };
+    vector<item_t> items;
+    string command = "run_batch";
+    string cmake_cache_path = build_script_executor_binary_dir + "/CMakeCache.txt";
+    auto cmake_cache_vars = fs::is_regular_file(cmake_cache_path)
+                                ? read_whole_cmake_cache(cmake_cache_path).vars
+                                : std::map<string, string>{};
+    for (auto& ps : pkgs_and_scripts) {
+        auto& deps_script_file = ps.second;
+        if (!cmake_cache_vars.empty()) {
+            auto lines = evaluate_deps_script_natively(deps_script_file, cmake_cache_vars);
+            if (lines) {
+                try {
+                    natively_evaluated[deps_script_file] =
+                        natively_evaluated_deps_script_t{file_sha(deps_script_file), move(*lines)};
+                } catch (...) {
+                    // run_deps_script will evaluate it again
+                }
+                continue;
+            }
+        }
+        // functions, macros, cache variables, etc.. defined by a script would be seen by the
+        // scripts after it, these are evaluated alone
+        if (strchr(deps_script_file.c_str(), ';') ||
+            try_get_deps_script_result_from_cache(cfg, deps_script_file,
+                                                  build_script_executor_binary_dir) ||
+            deps_script_may_affect_later_scripts(deps_script_file))
+            continue;
+        int i = items.size();
+        items.emplace_back(item_t{
+            deps_script_file,
+            stringf("%s-%d", build_script_add_pkg_out_file.c_str(), i),
+            stringf("%s-%d", build_script_included_files_out_file.c_str(), i)});
+        auto& item = items.back();
+        must_fopen(item.add_pkg_out_file, "w");
+        must_fopen(item.included_files_out_file, "w");
+        command += ";" + ps.first + ";" + item.deps_script_file + ";" + item.add_pkg_out_file +
+                   ";" + item.included_files_out_file;
+    }
+    if (items.size() < 2)
+        return 0;
+
+    test_cmake();
+    vector<string> args = {build_script_executor_binary_dir,
+                           string("-D") + k_executor_project_command_cache_var + "=" + command};
+    log_verbose("Evaluating %d dependency scripts in one batch.", (int)items.size());
+    LogWriter log(string_exec("cmake", args), cfg.cmakex_log_dir(),
+                  stringf("_batch-deps_script%s", k_log_extension), pipe_capture, pipe_capture);
+    int r;
+    try {
+        r = exec_process("cmake", args, log.stdout_callback(), log.stderr_callback());
+    } catch (...) {
+        r = ECANCELED;
+    }
+    log.finish(false);
+
+    int n = 0;
+    for (auto& item : items) {
+        try {
+            if (r == EXIT_SUCCESS) {
+                save_deps_script_result_to_cache(
+                    cfg, item.deps_script_file, build_script_executor_binary_dir,
+                    must_read_file_as_lines(item.included_files_out_file),
+                    must_read_file_as_lines(item.add_pkg_out_file));
+                ++n;
+            }
+            fs::remove(item.add_pkg_out_file);
+            fs::remove(item.included_files_out_file);
+        } catch (const exception& e) {
+            log_verbose("Failed to process the batch result of %s, reason: %s",
+                        path_for_log(item.deps_script_file).c_str(), e.what());
+        }
+    }
+    return n;
 }
 }
@@ -1,11 +1,22 @@
 #ifndef HELPER_CMAKE_PROJECT_92374039247
 #define HELPER_CMAKE_PROJECT_92374039247
 
+#include <map>
+
 #include "cmakex_utils.h"
 #include "using-decls.h"
 
 namespace cmakex {
 
+// the result of a deps script evaluated in-process, valid while the script has the same SHA
+struct natively_evaluated_deps_script_t
+{
+    string file_sha;
+    vector<string> add_pkg_lines;
+};
+// keyed by the path of the deps script
+using natively_evaluated_deps_scripts_t = std::map<string, natively_evaluated_deps_script_t>;
+
 class HelperCmakeProject
 {
 public:
@@ -13,9 +24,20 @@ public:
     // applies deps_accum_cmake_args if initial config, otherwise the applies the (incremental)
     // command_line_cmake_args
     void configure(const vector<string>& command_line_cmake_args, string_par pkg_name);
+    // returns the add_pkg/def_pkg lines. The result is cached, see deps_script_cache_t. A result
+    // found in `natively_evaluated` (by run_deps_scripts_in_batch) is taken from there.
     vector<string> run_deps_script(string_par deps_script_file,
                                    bool clear_downloaded_include_files,
-                                   string_par pkg_name);
+                                   string_par pkg_name,
+                                   natively_evaluated_deps_scripts_t* natively_evaluated = nullptr);
+    // Evaluates the deps scripts of the packages (pkg_name, deps_script_file) in a single cmake
+    // process and puts the results into the cache, so the subsequent run_deps_script calls won't
+    // launch cmake. The scripts which can be evaluated in-process are evaluated here, their results
+    // are added to `natively_evaluated`. The scripts which may affect the ones after them (see
+    // deps_script_may_affect_later_scripts) are left to run_deps_script. Failure is not an error,
+    // run_deps_script will evaluate and report. Returns the number of scripts evaluated by cmake.
+    int run_deps_scripts_in_batch(const vector<pair_ss>& pkgs_and_scripts,
+                                  natively_evaluated_deps_scripts_t& natively_evaluated);
 
     cmake_cache_t cmake_cache;  // read after configuration
 
@@ -25,6 +47,7 @@ private:
     const string build_script_executor_binary_dir;
     const string build_script_add_pkg_out_file;
     const string build_script_cmakex_out_file;
+    const string build_script_included_files_out_file;
 };
 }
 
@@ -13,6 +13,7 @@
 #include "installdb.h"
 #include "misc_utils.h"
 #include "print.h"
+#include "run_fingerprint.h"
 
 namespace cmakex {
 
@@ -243,6 +244,73 @@ void insert_new_request_into_wsp(const pkg_request_t& req_in, deps_recursion_wsp
     }
 }
 
+// starts cloning those of the packages which are about to be processed and would be cloned
+// there anyway: not yet processed, not found on a prefix path
+void prefetch_clones(string_par binary_dir,
+                     const vector<string>& pkgs,
+                     deps_recursion_wsp_t& wsp,
+                     const cmakex_cache_t& cmakex_cache)
+{
+    if (!wsp.clone_prefetcher)
+        return;
+
+    InstallDB installdb(binary_dir);
+    auto prefix_paths = stable_unique(
+        concat(cmakex_cache.cmakex_prefix_path_vector, cmakex_cache.env_cmakex_prefix_path_vector));
+
+    for (auto& p : pkgs) {
+        if (wsp.pkgs_to_process.count(p) == 0)
+            continue;
+        auto& pkg = wsp.pkg_map.at(p);
+        if (pkg.request.name_only())
+            continue;
+        if (!prefix_paths.empty()) {
+            string found_on_prefix_path;
+            try {
+                found_on_prefix_path =
+                    get<0>(installdb.quick_check_on_prefix_paths(p, prefix_paths));
+            } catch (...) {
+                continue;  // will be reported when processing the package
+            }
+            if (!found_on_prefix_path.empty())
+                continue;
+        }
+        wsp.clone_prefetcher->prefetch(p, pkg.request.c, pkg.request.git_shallow);
+    }
+}
+
+// evaluates the deps scripts of those of the packages about to be processed which are already
+// cloned (or being prefetched) in one cmake process. The results go to the deps script cache where
+// run_deps_script finds them when the packages are processed one by one
+void run_deps_scripts_in_batch(string_par binary_dir,
+                               const vector<string>& pkgs,
+                               deps_recursion_wsp_t& wsp)
+{
+    // the remote includes will be downloaded again, by the first script including them
+    if (wsp.clear_downloaded_include_files)
+        return;
+    const cmakex_config_t cfg(binary_dir);
+    vector<pair_ss> pkgs_and_scripts;
+    for (auto& p : pkgs) {
+        if (wsp.pkgs_to_process.count(p) == 0)
+            continue;
+        auto& pkg = wsp.pkg_map.at(p);
+        if (wsp.clone_prefetcher)
+            wsp.clone_prefetcher->wait_finished(p);
+        // must be the same path as install_deps_phase_one() uses for the package
+        string pkg_source_dir = cfg.pkg_clone_dir(p);
+        if (!pkg.request.b.source_dir.empty())
+            pkg_source_dir += "/" + pkg.request.b.source_dir;
+        string deps_script_file = fs::lexically_normal(fs::absolute(pkg_source_dir).string() +
+                                                       "/" + k_deps_script_filename);
+        if (fs::is_regular_file(deps_script_file))
+            pkgs_and_scripts.emplace_back(p, deps_script_file);
+    }
+    if (pkgs_and_scripts.size() > 1)
+        HelperCmakeProject(binary_dir)
+            .run_deps_scripts_in_batch(pkgs_and_scripts, wsp.natively_evaluated_deps_scripts);
+}
+
 idpo_recursion_result_t process_pkgs_to_process(string_par binary_dir,
                                                 const vector<string>& command_line_cmake_args,
                                                 const vector<config_name_t>& command_line_configs,
@@ -299,6 +367,9 @@ idpo_recursion_result_t install_deps_phase_one_request_deps(
     for (auto& d : request_deps)
         insert_new_request_into_wsp(pkg_request_t(d, command_line_configs, true), wsp);
 
+    prefetch_clones(binary_dir, request_deps, wsp, cmakex_cache);
+    run_deps_scripts_in_batch(binary_dir, request_deps, wsp);
+
     return process_pkgs_to_process(binary_dir, command_line_cmake_args, command_line_configs, wsp,
                                    cmakex_cache, request_deps);
 }
@@ -320,6 +391,8 @@ tuple<idpo_recursion_result_t, bool> install_deps_phase_one(
         if (custom_deps_script_file.empty()) {
             deps_script_file = fs::lexically_normal(fs::absolute(source_dir.str()).string() + "/" +
                                                     k_deps_script_filename);
+            // adding a deps script changes the dependencies, too
+            watch_file_for_run_fingerprint(deps_script_file);
             if (fs::is_regular_file(deps_script_file)) {
                 if (!request_deps.empty())
                     log_warn("Using dependency script %s instead of specified dependencies.",
@@ -371,7 +444,8 @@ idpo_recursion_result_t install_deps_phase_one_deps_script(
     HelperCmakeProject hcp(binary_dir);
     auto addpkgs_lines = hcp.run_deps_script(
         deps_script_file, wsp.clear_downloaded_include_files,
-        wsp.requester_stack.empty() ? "_main_project" : wsp.requester_stack.back().c_str());
+        wsp.requester_stack.empty() ? "_main_project" : wsp.requester_stack.back().c_str(),
+        &wsp.natively_evaluated_deps_scripts);
 
     vector<string> deps;
 
@@ -402,6 +476,10 @@ idpo_recursion_result_t install_deps_phase_one_deps_script(
                             join(keys_of_map(wsp.pkg_map), ", ").c_str());
         }
     }
+
+    prefetch_clones(binary_dir, deps, wsp, cmakex_cache);
+    run_deps_scripts_in_batch(binary_dir, deps, wsp);
+
     return process_pkgs_to_process(binary_dir, global_cmake_args, command_line_configs, wsp,
                                    cmakex_cache, deps);
 }
@@ -558,6 +636,10 @@ idpo_recursion_result_t run_deps_add_pkg(string_par pkg_name,
     // - to enumerate all dependencies
     // - to check if only compatible installations are requested
 
+    // the prefetcher may be cloning this package right now
+    if (wsp.clone_prefetcher)
+        wsp.clone_prefetcher->wait(pkg_name);
+
     clone_helper_t clone_helper(binary_dir, pkg_name);
     auto& cloned = clone_helper.cloned;
     auto& cloned_sha = clone_helper.cloned_sha;
@@ -650,7 +732,8 @@ idpo_recursion_result_t run_deps_add_pkg(string_par pkg_name,
             // try if the target SHA can be found locally
             bool sha_is_valid = git_is_existing_commit(clone_dir, target_git_sha);
             if (!sha_is_valid) {
-                // try to fetch
+                // try to fetch, if the clone is referencing a mirror most objects come from there
+                git_mirror_of_url(pkg.request.c.git_url);
                 exec_git({"fetch"}, clone_dir, nullptr, nullptr, log_git_command_always);
                 sha_is_valid = git_is_existing_commit(clone_dir, gt);
                 if (!sha_is_valid) {
@@ -1096,8 +1179,7 @@ idpo_recursion_result_t run_deps_add_pkg(string_par pkg_name,
                             // this config of the dependency was installed and is
                             // installed
                             // check if it has been changed
-                            string dep_current_sha =
-                                calc_sha(dep_current_install.config_descs.at(config));
+                            auto& dep_current_sha = dep_current_install.config_sha(config);
                             string dep_previnst_sha = it_previnst_dep_configs->second.at(config);
                             if (dep_current_sha != dep_previnst_sha) {
                                 build_reasons[config] = {
@@ -1126,7 +1208,7 @@ idpo_recursion_result_t run_deps_add_pkg(string_par pkg_name,
                                     break;
                                 }
                                 CHECK(it1 != map1.end() && it2 != map2.end());
-                                if (calc_sha(it1->second) != it2->second) {
+                                if (dep_current_install.config_sha(c) != it2->second) {
                                     changed_config = &c;
                                     break;
                                 }
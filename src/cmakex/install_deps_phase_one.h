@@ -3,10 +3,13 @@
 
 #include <set>
 
+#include "helper_cmake_project.h"
 #include "installdb.h"
 
 namespace cmakex {
 
+class clone_prefetcher_t;
+
 struct manifest_of_config_t
 {
     string git_url;
@@ -62,6 +65,9 @@ struct deps_recursion_wsp_t
     bool update_can_leave_branch = false;
     bool update_stop_on_error = true;
     bool update_can_reset = false;
+    clone_prefetcher_t* clone_prefetcher = nullptr;  // optional, clones packages in advance
+    // results of the deps scripts evaluated by run_deps_scripts_in_batch, taken by run_deps_script
+    natively_evaluated_deps_scripts_t natively_evaluated_deps_scripts;
 };
 
 // install_deps_phase_one recursion result: aggregates certain data below a node in the recursion
@@ -1,15 +1,26 @@
 #include "install_deps_phase_two.h"
 
+#include <atomic>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+
 #include <adasworks/sx/algorithm.h>
 #include <adasworks/sx/check.h>
 #include <adasworks/sx/log.h>
 
+#include "binary_cache.h"
 #include "build.h"
+#include "build_slots.h"
 #include "clone.h"
 #include "cmakex_utils.h"
 #include "git.h"
 #include "misc_utils.h"
+#include "package_repository.h"
 #include "print.h"
+#include "step_durations.h"
 
 namespace cmakex {
 
@@ -22,11 +33,173 @@ vector<string> replace_empty_config(vector<string> x)
     return x;
 }
 
+int max_configs_to_build(const deps_recursion_wsp_t& wsp)
+{
+    int r = 1;
+    for (auto& p : wsp.build_order) {
+        int n = 0;
+        for (auto& kv : wsp.pkg_map.at(p).pcd) {
+            if (!kv.second.build_reasons.empty())
+                ++n;
+        }
+        r = std::max(r, n);
+    }
+    return r;
+}
+
+// Sum of the recorded durations of the cmake steps of the configs of the package which are going
+// to be built. Steps never recorded (first build, failed before) count as zero.
+double estimated_build_duration(const string& pkg,
+                                const deps_recursion_wsp_t& wsp,
+                                const step_durations_t& durations)
+{
+    double r = 0;
+    for (auto& kv : wsp.pkg_map.at(pkg).pcd) {
+        if (kv.second.build_reasons.empty())
+            continue;
+        const char* c = kv.first.get_prefer_NoConfig().c_str();
+        for (auto step : {"configure", "build-all", "build-install"}) {
+            auto it = durations.find(stringf("%s-%s-%s", pkg.c_str(), c, step));
+            if (it != durations.end())
+                r += it->second;
+        }
+    }
+    return r;
+}
+
+// Builds the packages of wsp.build_order on at most `jobs` threads. A package is started as soon
+// as all of its dependencies which are also being built now are finished. Of the packages ready to
+// be built the one heading the longest chain of remaining builds (critical path, estimated from the
+// durations recorded in the previous runs) is started first, ties are started in build order.
+// After the first failure no new packages are started, the running ones are waited for and the
+// first exception is rethrown. The packages finished by then stay installed and registered.
+void build_pkgs_in_parallel(const deps_recursion_wsp_t& wsp,
+                            int jobs,
+                            const step_durations_t& durations,
+                            const std::function<void(const string&)>& build_pkg)
+{
+    const auto& build_order = wsp.build_order;
+    const int n = build_order.size();
+
+    std::map<string, int> index_of;
+    for (int i = 0; i < n; ++i)
+        index_of[build_order[i]] = i;
+
+    // for each package: number of unfinished dependencies and the packages depending on it,
+    // considering only the packages in build_order, the others are already installed
+    vector<int> unfinished_deps(n, 0);
+    vector<vector<int>> dependents(n);
+    for (int i = 0; i < n; ++i) {
+        for (auto& d : wsp.pkg_map.at(build_order[i]).request.depends) {
+            auto it = index_of.find(d);
+            if (it == index_of.end())
+                continue;
+            ++unfinished_deps[i];
+            dependents[it->second].emplace_back(i);
+        }
+    }
+
+    // longest path to the end of the build, a package's own duration included. build_order is
+    // topologically sorted so the dependents come later
+    vector<double> critical_path(n, 0);
+    for (int i = n - 1; i >= 0; --i) {
+        double longest_dependent = 0;
+        for (int j : dependents[i])
+            longest_dependent = std::max(longest_dependent, critical_path[j]);
+        critical_path[i] =
+            estimated_build_duration(build_order[i], wsp, durations) + longest_dependent;
+    }
+
+    std::mutex mutex;
+    std::condition_variable cv;
+    // (-critical path, index into build_order), the first is started first
+    std::set<std::pair<double, int>> ready;
+    vector<string> finished, running;
+    std::exception_ptr first_error;
+    string failed_pkg;
+
+    for (int i = 0; i < n; ++i) {
+        if (unfinished_deps[i] == 0)
+            ready.insert(std::make_pair(-critical_path[i], i));
+    }
+
+    auto worker = [&]() {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            cv.wait(lock, [&]() { return first_error || !ready.empty() || running.empty(); });
+            if (first_error || ready.empty())
+                break;
+            const int i = ready.begin()->second;
+            ready.erase(ready.begin());
+            const string& p = build_order[i];
+            running.emplace_back(p);
+            lock.unlock();
+
+            std::exception_ptr error;
+            try {
+                build_pkg(p);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            running.erase(std::find(BEGINEND(running), p));
+            if (error) {
+                if (!first_error) {
+                    first_error = error;
+                    failed_pkg = p;
+                }
+            } else {
+                finished.emplace_back(p);
+                for (int j : dependents[i]) {
+                    if (--unfinished_deps[j] == 0)
+                        ready.insert(std::make_pair(-critical_path[j], j));
+                }
+            }
+            cv.notify_all();
+        }
+    };
+
+    const int n_threads = std::min(jobs, n);
+    log_info("Building %d packages on %d parallel jobs.", n, n_threads);
+    double longest_path = *std::max_element(BEGINEND(critical_path));
+    if (longest_path > 0)
+        log_verbose("Critical path estimated from the previous builds: %.1f s", longest_path);
+    vector<std::thread> threads;
+    threads.reserve(n_threads);
+    for (int i = 0; i < n_threads; ++i)
+        threads.emplace_back(worker);
+    for (auto& t : threads)
+        t.join();
+
+    if (first_error) {
+        log_error("Failed to build %s.", pkg_for_log(failed_pkg).c_str());
+        if (!finished.empty())
+            log_error("Packages built and installed before the failure: %s.",
+                      join(finished, ", ").c_str());
+        vector<string> not_built;
+        for (auto& p : build_order) {
+            if (p != failed_pkg && !is_one_of(p, finished))
+                not_built.emplace_back(p);
+        }
+        if (!not_built.empty())
+            log_error("Packages not built: %s.", join(not_built, ", ").c_str());
+        std::rethrow_exception(first_error);
+    }
+    CHECK((int)finished.size() == n,
+          "Internal error: dependency cycle among the packages to build.");
+}
+
 void install_deps_phase_two(string_par binary_dir,
                             deps_recursion_wsp_t& wsp,
                             bool force_config_step,
                             const vector<string>& build_args,
-                            const vector<string>& native_tool_args)
+                            const vector<string>& native_tool_args,
+                            int pkg_jobs,
+                            bool parallel_configs,
+                            string_par binary_cache_dir,
+                            PackageSourcePolicy package_source_policy,
+                            string_par package_repository)
 {
     log_info();
 
@@ -42,7 +215,7 @@ void install_deps_phase_two(string_par binary_dir,
         installed_config_desc_t desc(p, config);
         desc.git_url = wp.request.c.git_url;
         if (cloned_sha == k_sha_uncommitted) {
-            desc.git_sha = stringf("<installed-from-uncommited-changes-at-%s",
+            desc.git_sha = stringf("%s-at-%s", k_installed_from_uncommitted_prefix,
                                    current_datetime_string_for_log().c_str());
         } else {
             desc.git_sha = wp.resolved_git_tag;
@@ -51,8 +224,8 @@ void install_deps_phase_two(string_par binary_dir,
         desc.final_cmake_args = wp.pcd.at(config).tentative_final_cmake_args;
         for (auto& d : wp.request.depends) {
             auto dep_installed = installdb.try_get_installed_pkg_all_configs(d, prefix_paths);
-            for (auto& kv : dep_installed.config_descs)
-                desc.deps_shas[d][kv.first] = calc_sha(kv.second);
+            for (auto& kv : dep_installed.config_shas)
+                desc.deps_shas[d][kv.first] = kv.second;
         }
         desc.hijack_modules_needed = hijack_modules_needed;
         return desc;
@@ -92,7 +265,23 @@ void install_deps_phase_two(string_par binary_dir,
         moc.toolchain_sha = final_cmake_args.cmake_toolchain_file_sha;
         return moc;
     };
-    for (auto& p : wsp.build_order) {
+    const bool use_package_repository = package_source_policy != package_source_local_build;
+    // the archives fetched from the package repository are unpacked into a binary cache, into one
+    // in the build dir if there's no machine-wide one
+    string cache_dir = binary_cache_dir.str();
+    if (cache_dir.empty() && use_package_repository)
+        cache_dir = cfg.cmakex_dir() + "/binary_cache";
+
+    // configs of a package can be built at the same time only if they have separate binary dirs
+    const bool parallel_configs_now = parallel_configs && cfg.cmakex_cache().per_config_bin_dirs;
+    // the cmake steps of the packages and configs built in parallel share this limit
+    build_slots_t build_slots(std::max<int>(
+        pkg_jobs, parallel_configs_now ? max_configs_to_build(wsp) : 1));
+
+    // only the InstallDB access and the hijack modules are shared between the packages and configs
+    // being built in parallel
+    std::mutex installdb_mutex;
+    auto build_pkg = [&](const string& p) {
         // pkgs_to_moc.erase(p);
         log_datetime();
         auto& wp = wsp.pkg_map.at(p);
@@ -112,8 +301,14 @@ void install_deps_phase_two(string_par binary_dir,
 
         clone_helper_t clone_helper(binary_dir, p);
 
-        bool force_config_step_now = force_config_step;
-        for (auto& config : configs_to_build) {
+        // for a multiconfig generator we're forcing cmake-config step only for the first
+        // configuration built. Subsequent configurations share the same binary dir and fed with
+        // the same cmake args.
+        // for single-config generator it's either single-bin-dir (needs to force each config)
+        // or per-config-bin-dir (also needs to force each config)
+        // The configs may be built in parallel, the flag is taken atomically.
+        std::atomic<bool> force_first_config_step(force_config_step);
+        auto build_config = [&](const config_name_t& config) {
             {
                 auto& br = wp.pcd.at(config).build_reasons;
                 auto it = br.begin();
@@ -126,24 +321,57 @@ void install_deps_phase_two(string_par binary_dir,
                 for (++it; it != br.end(); ++it)
                     log_info("%s%s", s1.c_str(), it->c_str());
             }
+            CHECK(clone_helper.cloned);
+            string cache_key;
+            if (!cache_dir.empty()) {
+                std::lock_guard<std::mutex> lock(installdb_mutex);
+                cache_key = binary_cache_key(create_desc(p, config, wp, {}, clone_helper.cloned_sha),
+                                             installdb, prefix_paths, cfg);
+            }
+            if (!cache_key.empty() && !wsp.force_build) {
+                auto hijack_modules_needed =
+                    restore_from_binary_cache(cache_dir, cache_key, cfg.deps_install_dir());
+                const char* restored_from = "the binary cache";
+                if (!hijack_modules_needed && use_package_repository &&
+                    fetch_from_package_repository(package_repository, p, cache_key, cache_dir,
+                                                  cfg.cmakex_tmp_dir())) {
+                    hijack_modules_needed =
+                        restore_from_binary_cache(cache_dir, cache_key, cfg.deps_install_dir());
+                    restored_from = "the package repository";
+                }
+                if (hijack_modules_needed) {
+                    log_info("Installed '%s' from %s.", config.get_prefer_NoConfig().c_str(),
+                             restored_from);
+                    std::lock_guard<std::mutex> lock(installdb_mutex);
+                    for (auto& base : *hijack_modules_needed)
+                        write_hijack_module(base, binary_dir);
+                    installdb.install_with_unspecified_files(create_desc(
+                        p, config, wp, *hijack_modules_needed, clone_helper.cloned_sha));
+                    return;
+                }
+            }
+            if (package_source_policy == package_source_force_server_build)
+                throwf("%s - %s is not available in the package repository %s and the package "
+                       "source policy is 'force_server_build'.",
+                       pkg_for_log(p).c_str(), config.get_prefer_NoConfig().c_str(),
+                       package_repository.c_str());
+            const bool force_config_step_now = cfg.cmakex_cache().multiconfig_generator
+                                                   ? force_first_config_step.exchange(false)
+                                                   : force_config_step;
             auto build_result =
                 build(binary_dir, p, wp.request.b.source_dir, wp.pcd.at(config).cmake_args_to_apply,
                       config, {"", "install"}, force_config_step_now, cfg.cmakex_cache(),
                       build_args, native_tool_args);
 
-            for (auto& base : build_result.hijack_modules_needed)
-                write_hijack_module(base, binary_dir);
+            {
+                std::lock_guard<std::mutex> lock(installdb_mutex);
+                for (auto& base : build_result.hijack_modules_needed)
+                    write_hijack_module(base, binary_dir);
+            }
 
-            // for a multiconfig generator we're forcing cmake-config step only for the first
-            // configuration. Subsequent configurations share the same binary dir and fed with the
-            // same cmake args.
-            // for single-config generator it's either single-bin-dir (needs to force each config)
-            // or per-config-bin-dir (also needs to force each config)
-            if (cfg.cmakex_cache().multiconfig_generator)
-                force_config_step_now = false;
             // copy or link installed files into install prefix
             // register this build with installdb
-            CHECK(clone_helper.cloned);
+            std::unique_lock<std::mutex> lock(installdb_mutex);
             auto desc = create_desc(p, config, wp, build_result.hijack_modules_needed,
                                     clone_helper.cloned_sha);
 
@@ -152,9 +380,41 @@ void install_deps_phase_two(string_par binary_dir,
                         wp.manifests_per_config.insert(std::make_pair(config, move(moc)));
             */
             installdb.install_with_unspecified_files(desc);
+            lock.unlock();
+            if (!cache_key.empty()) {
+                store_in_binary_cache(cache_dir, cache_key, desc,
+                                      cfg.pkg_binary_dir_of_config(
+                                          p, config, cfg.cmakex_cache().per_config_bin_dirs),
+                                      cfg.deps_install_dir());
+                if (package_source_policy == package_source_server_build)
+                    publish_to_package_repository(package_repository, p, cache_key, cache_dir);
+            }
+        };
+
+        if (parallel_configs_now && configs_to_build.size() > 1) {
+            run_with_build_slots(configs_to_build.size(), build_slots,
+                                 [&](int i) { build_config(configs_to_build[i]); });
+        } else {
+            for (auto& config : configs_to_build) {
+                build_slot_guard_t slot(build_slots);
+                build_config(config);
+            }
         }
         log_info();
-    }  // iterate over build order
+    };
+
+    const bool parallel_pkgs = pkg_jobs > 1 && wsp.build_order.size() > 1;
+    // the output of the parallel cmake processes would be interleaved on the console, it's only
+    // saved to the log files (and printed on failure)
+    if (parallel_pkgs || parallel_configs_now)
+        g_supress_deps_cmake_logs = true;
+    if (parallel_pkgs)
+        build_pkgs_in_parallel(wsp, pkg_jobs, load_step_durations(cfg.cmakex_log_dir()),
+                               build_pkg);
+    else {
+        for (auto& p : wsp.build_order)
+            build_pkg(p);
+    }
     for (auto& kv : wsp.pkg_map) {
         auto& p = kv.first;
         auto& wp = kv.second;
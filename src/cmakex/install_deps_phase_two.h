@@ -8,11 +8,20 @@ namespace cmakex {
 // iterarate build order
 // check each item if it must be built or not
 // build & install if needed
+// pkg_jobs > 1: build independent packages in parallel
+// parallel_configs: build the configs of a package in parallel (with per-config binary dirs)
+// binary_cache_dir: if not empty, restore the configs from / save them into this binary cache
+// package_source_policy, package_repository: see --package-source-policy
 void install_deps_phase_two(string_par binary_dir,
                             deps_recursion_wsp_t& wsp,
                             bool force_config_step,
                             const vector<string>& build_args,
-                            const vector<string>& native_tool_args);
+                            const vector<string>& native_tool_args,
+                            int pkg_jobs,
+                            bool parallel_configs,
+                            string_par binary_cache_dir,
+                            PackageSourcePolicy package_source_policy,
+                            string_par package_repository);
 }
 
 #endif
@@ -1,6 +1,12 @@
 #include "installdb.h"
 
+#include <cstring>
+#include <iterator>
+#include <mutex>
+#include <sstream>
+
 #include <Poco/DirectoryIterator.h>
+#include <Poco/Process.h>
 #include <Poco/SHA1Engine.h>
 #include <adasworks/sx/algorithm.h>
 
@@ -91,18 +97,315 @@ string calc_sha(const installed_config_desc_t& x)
     return string_sha(oss.str());
 }
 
+void installed_pkg_configs_t::put(installed_config_desc_t desc)
+{
+    auto config = desc.config;
+    config_shas[config] = calc_sha(desc);
+    config_descs.erase(config);
+    config_descs.emplace(config, move(desc));
+}
+
+bool installed_pkg_configs_t::erase(const config_name_t& config)
+{
+    config_shas.erase(config);
+    return config_descs.erase(config) > 0;
+}
+
 namespace {
 string dbpath_from_prefix_path(string_par prefix_path)
 {
     return prefix_path.str() + "/_cmakex/installdb";
 }
+
+// The installed configs of the packages read in this process, keyed by the package's directory in
+// an installdb (local or on a prefix path). A package directory is read only once, InstallDB
+// writes the changes through to both the files and the index.
+struct installdb_index_t
+{
+    struct binary_db_t
+    {
+        int journal_records = 0;
+        bool journal_torn = false;  // a write has been interrupted, there's garbage at the end
+    };
+
+    std::mutex mutex;
+    std::map<string, installed_pkg_configs_t> pkg_dirs;
+    std::map<string, maybe<binary_db_t>> dbs;  // keyed by the installdb path, nothing for JSON
+};
+
+installdb_index_t& installdb_index()
+{
+    static installdb_index_t x;
+    return x;
+}
+
+// the same directory may be referred to differently, e.g. as a prefix path and as the local
+// installdb
+string installdb_index_key(string_par pkg_desc_dir)
+{
+    return fs::lexically_normal(fs::absolute(pkg_desc_dir.c_str())).string();
+}
+
+// The binary installdb is a snapshot (<installdb>.bin) and an append-only journal
+// (<installdb>.journal) of the changes made since the snapshot. Both files contain checksummed
+// records, an incomplete record at the end of the journal (interrupted write) is ignored. The
+// journal is compacted into a new snapshot when it grows too long: the snapshot is written to a
+// temporary file and renamed, then the journal is removed. Replaying the journal again is
+// harmless if this is interrupted.
+const char* const k_installdb_snapshot_magic = "cmakex-installdb-snapshot-1\n";
+const char* const k_installdb_journal_magic = "cmakex-installdb-journal-1\n";
+const int k_installdb_max_journal_records = 100;
+
+enum installdb_journal_op_t : uint8_t
+{
+    journal_op_put = 1,
+    journal_op_remove = 2
+};
+
+string installdb_snapshot_path(string_par dbpath)
+{
+    return dbpath.str() + ".bin";
+}
+
+string installdb_journal_path(string_par dbpath)
+{
+    return dbpath.str() + ".journal";
+}
+
+bool is_binary_installdb(string_par dbpath)
+{
+    return fs::is_regular_file(installdb_snapshot_path(dbpath)) ||
+           fs::is_regular_file(installdb_journal_path(dbpath));
+}
+
+string read_binary_file(string_par path)
+{
+    nowide::ifstream f(path.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!f.good())
+        throwf("Can't open existing file %s for reading.", path_for_log(path).c_str());
+    return string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+void write_binary_file(const file_t& f, string_par path, const string& data)
+{
+    if (fwrite(data.data(), 1, data.size(), f.stream()) != data.size() || fflush(f.stream()))
+        throwf("Can't write %s.", path_for_log(path).c_str());
+}
+
+// record: 4-byte little-endian size, payload, SHA of the payload
+void append_record(string& data, const string& payload)
+{
+    uint32_t n = payload.size();
+    for (int i = 0; i < 4; ++i)
+        data.push_back(char((n >> (8 * i)) & 0xff));
+    data += payload;
+    data += string_sha(payload);
+}
+
+// returns false if there's no complete, valid record at `pos`
+bool read_record(const string& data, size_t& pos, string& payload)
+{
+    static const size_t sha_size = string_sha("").size();
+    if (data.size() < pos + 4)
+        return false;
+    uint32_t n = 0;
+    for (int i = 0; i < 4; ++i)
+        n |= uint32_t((unsigned char)data[pos + i]) << (8 * i);
+    if (data.size() - pos - 4 < n + sha_size)
+        return false;
+    payload = data.substr(pos + 4, n);
+    if (data.compare(pos + 4 + n, sha_size, string_sha(payload)) != 0)
+        return false;
+    pos += 4 + n + sha_size;
+    return true;
+}
+
+installed_config_desc_t load_desc(cereal::PortableBinaryInputArchive& a)
+{
+    auto d = installed_config_desc_t::uninitialized_installed_config_desc();
+    a(d);
+    return d;
+}
+
+void load_installdb_snapshot(string_par path, std::map<string, installed_pkg_configs_t>& pkgs)
+{
+    auto data = read_binary_file(path);
+    size_t pos = strlen(k_installdb_snapshot_magic);
+    string payload;
+    if (data.compare(0, pos, k_installdb_snapshot_magic) != 0 || !read_record(data, pos, payload))
+        throwf("Invalid or corrupt installdb file: %s", path_for_log(path).c_str());
+    std::istringstream iss(payload);
+    cereal::PortableBinaryInputArchive a(iss);
+    uint32_t n;
+    a(n);
+    for (uint32_t i = 0; i < n; ++i) {
+        auto d = load_desc(a);
+        auto pkg_name = d.pkg_name;
+        pkgs[pkg_name].put(move(d));
+    }
+}
+
+// returns the number of records replayed
+int replay_installdb_journal(string_par path,
+                             std::map<string, installed_pkg_configs_t>& pkgs,
+                             bool& torn)
+{
+    auto data = read_binary_file(path);
+    size_t pos = strlen(k_installdb_journal_magic);
+    torn = data.compare(0, pos, k_installdb_journal_magic) != 0;
+    int n = 0;
+    string payload;
+    while (!torn && pos < data.size()) {
+        if (!read_record(data, pos, payload)) {
+            torn = true;
+            break;
+        }
+        std::istringstream iss(payload);
+        cereal::PortableBinaryInputArchive a(iss);
+        uint8_t op;
+        a(op);
+        if (op == journal_op_put) {
+            auto d = load_desc(a);
+            auto pkg_name = d.pkg_name;
+            pkgs[pkg_name].put(move(d));
+        } else if (op == journal_op_remove) {
+            string pkg_name, config;
+            a(pkg_name, config);
+            auto it = pkgs.find(pkg_name);
+            if (it != pkgs.end())
+                it->second.erase(config_name_t(config));
+        } else {
+            torn = true;
+            break;
+        }
+        ++n;
+    }
+    if (torn)
+        log_warn("Ignoring the incomplete records at the end of %s.", path_for_log(path).c_str());
+    return n;
+}
+
+// returns the entry of the installdb, loads a binary installdb into the index at the first call
+maybe<installdb_index_t::binary_db_t>& open_installdb(installdb_index_t& index, string_par dbpath)
+{
+    auto key = installdb_index_key(dbpath);
+    auto it = index.dbs.find(key);
+    if (it != index.dbs.end())
+        return it->second;
+    maybe<installdb_index_t::binary_db_t> db;
+    if (is_binary_installdb(dbpath)) {
+        db = just(installdb_index_t::binary_db_t{});
+        std::map<string, installed_pkg_configs_t> pkgs;
+        auto snapshot_path = installdb_snapshot_path(dbpath);
+        if (fs::is_regular_file(snapshot_path))
+            load_installdb_snapshot(snapshot_path, pkgs);
+        auto journal_path = installdb_journal_path(dbpath);
+        if (fs::is_regular_file(journal_path))
+            db->journal_records = replay_installdb_journal(journal_path, pkgs, db->journal_torn);
+        for (auto& kv : pkgs)
+            index.pkg_dirs[installdb_index_key(key + "/" + kv.first)] = move(kv.second);
+    }
+    return index.dbs.emplace(key, move(db)).first->second;
+}
+
+void write_installdb_snapshot(installdb_index_t& index, string_par dbpath)
+{
+    auto prefix = installdb_index_key(dbpath) + "/";
+    std::ostringstream oss;
+    {
+        vector<const installed_config_desc_t*> descs;
+        for (auto it = index.pkg_dirs.lower_bound(prefix);
+             it != index.pkg_dirs.end() && starts_with(it->first, prefix); ++it) {
+            for (auto& kv : it->second.config_descs)
+                descs.emplace_back(&kv.second);
+        }
+        cereal::PortableBinaryOutputArchive a(oss);
+        a(uint32_t(descs.size()));
+        for (auto d : descs)
+            a(*d);
+    }
+    string data = k_installdb_snapshot_magic;
+    append_record(data, oss.str());
+
+    auto path = installdb_snapshot_path(dbpath);
+    auto tmp = stringf("%s.tmp-%ld", path.c_str(), (long)Poco::Process::id());
+    {
+        // the new snapshot must be on the disk before it replaces the old one and the journal
+        // is removed, otherwise a crash may leave an empty or partial snapshot behind
+        auto f = must_fopen(tmp, "wb");
+        write_binary_file(f, tmp, data);
+        must_fsync(f, tmp);
+    }
+    fs::rename(tmp, path);
+    must_fsync_dir(fs::path(path).parent_path().string());
+    auto journal_path = installdb_journal_path(dbpath);
+    if (fs::exists(journal_path))
+        fs::remove(journal_path);
+}
+
+// the change must have already been applied to the index
+void commit_installdb_change(installdb_index_t& index,
+                             string_par dbpath,
+                             installdb_index_t::binary_db_t& db,
+                             const string& payload)
+{
+    if (db.journal_torn || db.journal_records >= k_installdb_max_journal_records) {
+        write_installdb_snapshot(index, dbpath);
+        db.journal_torn = false;
+        db.journal_records = 0;
+        return;
+    }
+    auto path = installdb_journal_path(dbpath);
+    string data;
+    if (!fs::is_regular_file(path))
+        data = k_installdb_journal_magic;
+    append_record(data, payload);
+    write_binary_file(must_fopen(path, "ab"), path, data);
+    ++db.journal_records;
+}
+
+string journal_put_payload(const installed_config_desc_t& desc)
+{
+    std::ostringstream oss;
+    {
+        cereal::PortableBinaryOutputArchive a(oss);
+        a(uint8_t(journal_op_put), desc);
+    }
+    return oss.str();
+}
+
+string journal_remove_payload(string_par pkg_name, const config_name_t& config)
+{
+    std::ostringstream oss;
+    {
+        cereal::PortableBinaryOutputArchive a(oss);
+        a(uint8_t(journal_op_remove), pkg_name.str(), config.get_prefer_NoConfig());
+    }
+    return oss.str();
+}
+}
+
+vector<string> installdb_files(string_par prefix_path)
+{
+    auto dbpath = dbpath_from_prefix_path(prefix_path);
+    vector<string> r{dbpath, installdb_snapshot_path(dbpath), installdb_journal_path(dbpath)};
+    if (!fs::is_directory(dbpath))
+        return r;
+    for (Poco::DirectoryIterator it(dbpath); it != Poco::DirectoryIterator(); ++it) {
+        r.emplace_back(it->path());
+        if (!it->isDirectory())
+            continue;
+        for (Poco::DirectoryIterator it2(it->path()); it2 != Poco::DirectoryIterator(); ++it2)
+            r.emplace_back(it2->path());
+    }
+    return r;
 }
 
 InstallDB::InstallDB(string_par binary_dir)
     : binary_dir(binary_dir.str()),
       dbpath(dbpath_from_prefix_path(cmakex_config_t(binary_dir).deps_install_dir()))
 {
-    if (!fs::exists(dbpath))
+    if (!fs::exists(dbpath) && !is_binary_installdb(dbpath))
         fs::create_directories(dbpath);  // must be able to create the path
 }
 
@@ -121,6 +424,25 @@ installed_pkg_configs_t InstallDB::try_get_installed_pkg_all_configs(
 
 installed_pkg_configs_t InstallDB::try_get_installed_pkg_all_configs(string_par pkg_name,
                                                                      string_par prefix_path) const
+{
+    auto& index = installdb_index();
+    std::lock_guard<std::mutex> lock(index.mutex);
+    auto& db =
+        open_installdb(index, prefix_path.empty() ? dbpath : dbpath_from_prefix_path(prefix_path));
+    auto key = installdb_index_key(installed_pkg_desc_dir(pkg_name, prefix_path));
+    auto it = index.pkg_dirs.find(key);
+    if (it == index.pkg_dirs.end()) {
+        // a binary installdb has been loaded entirely
+        it = index.pkg_dirs
+                 .emplace(key, db ? installed_pkg_configs_t()
+                                  : load_installed_pkg_all_configs(pkg_name, prefix_path))
+                 .first;
+    }
+    return it->second;
+}
+
+installed_pkg_configs_t InstallDB::load_installed_pkg_all_configs(string_par pkg_name,
+                                                                  string_par prefix_path) const
 {
     installed_pkg_configs_t r;
     auto paths = glob_installed_pkg_config_descs(pkg_name, prefix_path);
@@ -146,13 +468,13 @@ installed_pkg_configs_t InstallDB::try_get_installed_pkg_all_configs(string_par
                    path_for_log(p).c_str(), y.config.get_prefer_NoConfig().c_str(), v.c_str());
         }
 
-        auto new_result_value_it_bool = r.config_descs.emplace(y.config, y);
-        if (!new_result_value_it_bool.second)
+        if (r.config_descs.count(y.config) > 0)
             throwf(
                 "Installed-configuration file %s contains configuration '%s' but that config "
                 "has already been listed in another installed-configuration file of the same "
                 "package.",
                 path_for_log(p).c_str(), y.config.get_prefer_NoConfig().c_str());
+        r.put(move(y));
     }
     return r;
 }
@@ -173,9 +495,24 @@ void InstallDB::put_installed_pkg_desc(installed_config_desc_t p)
 {
     p.final_cmake_args.args = normalize_cmake_args(p.final_cmake_args.args);
     auto dir = installed_pkg_desc_dir(p.pkg_name, "");
+    auto& index = installdb_index();
+    std::lock_guard<std::mutex> lock(index.mutex);
+    auto& db = open_installdb(index, dbpath);
+    auto key = installdb_index_key(dir);
+    if (db) {
+        auto payload = journal_put_payload(p);
+        index.pkg_dirs[key].put(move(p));
+        commit_installdb_change(index, dbpath, *db, payload);
+        return;
+    }
+
     fs::create_directories(dir);
     auto path = installed_pkg_config_desc_path(p.pkg_name, p.config);
     save_json_output_archive(path, p);
+
+    auto it = index.pkg_dirs.find(key);
+    if (it != index.pkg_dirs.end())
+        it->second.put(move(p));
 }
 
 /*void InstallDB::put_installed_pkg_files(string_par pkg_name, const pkg_files_t& p)
@@ -388,9 +725,62 @@ void remove_and_log_error(string_par f)
 void InstallDB::uninstall_config_if_installed(string_par pkg_name, const config_name_t& config)
 {
     // todo uninstall files, too, if they're registered with this installation
+    auto& index = installdb_index();
+    std::lock_guard<std::mutex> lock(index.mutex);
+    auto& db = open_installdb(index, dbpath);
+    auto it = index.pkg_dirs.find(installdb_index_key(installed_pkg_desc_dir(pkg_name, "")));
+    if (db) {
+        if (it != index.pkg_dirs.end() && it->second.erase(config))
+            commit_installdb_change(index, dbpath, *db, journal_remove_payload(pkg_name, config));
+        return;
+    }
+
     string path = installed_pkg_config_desc_path(pkg_name, config);
     if (fs::exists(path))
         remove_and_log_error(path);
+    if (it != index.pkg_dirs.end())
+        it->second.erase(config);
+}
+
+void InstallDB::convert(bool to_binary)
+{
+    auto& index = installdb_index();
+    std::lock_guard<std::mutex> lock(index.mutex);
+    auto& db = open_installdb(index, dbpath);
+    if (!!db == to_binary)
+        return;
+    if (to_binary) {
+        // read all the packages
+        if (fs::is_directory(dbpath)) {
+            for (Poco::DirectoryIterator it(dbpath); it != Poco::DirectoryIterator(); ++it) {
+                if (!it->isDirectory())
+                    continue;
+                auto key = installdb_index_key(installed_pkg_desc_dir(it.name(), ""));
+                if (index.pkg_dirs.count(key) == 0)
+                    index.pkg_dirs.emplace(key, load_installed_pkg_all_configs(it.name(), ""));
+            }
+        }
+        write_installdb_snapshot(index, dbpath);
+        fs::remove_all(dbpath);
+        db = just(installdb_index_t::binary_db_t{});
+    } else {
+        auto prefix = installdb_index_key(dbpath) + "/";
+        for (auto it = index.pkg_dirs.lower_bound(prefix);
+             it != index.pkg_dirs.end() && starts_with(it->first, prefix); ++it) {
+            for (auto& kv : it->second.config_descs) {
+                fs::create_directories(installed_pkg_desc_dir(kv.second.pkg_name, ""));
+                save_json_output_archive(
+                    installed_pkg_config_desc_path(kv.second.pkg_name, kv.first), kv.second);
+            }
+        }
+        for (auto& p : {installdb_snapshot_path(dbpath), installdb_journal_path(dbpath)}) {
+            if (fs::exists(p))
+                fs::remove(p);
+        }
+        db = nothing;
+    }
+    log_info("Converted the installdb %s to the %s format.", path_for_log(dbpath).c_str(),
+             to_binary ? "binary" : "JSON");
 }
 tuple<string, vector<config_name_t>> InstallDB::quick_check_on_prefix_paths(
     string_par pkg_name,
@@ -407,10 +797,10 @@ tuple<string, vector<config_name_t>> InstallDB::quick_check_on_prefix_paths(
     v.reserve(prefix_paths.size() + 1);
 
     // collect prefix paths to check on
-    if (!glob_installed_pkg_config_descs(pkg_name, "").empty())
+    if (!try_get_installed_pkg_all_configs(pkg_name, "").empty())
         v.emplace_back(deps_install_dir);
     for (auto& p : prefix_paths) {
-        if (!glob_installed_pkg_config_descs(pkg_name, p).empty())
+        if (!try_get_installed_pkg_all_configs(pkg_name, p).empty())
             v.emplace_back(p);
     }
 
@@ -18,6 +18,9 @@ tuple<vector<string>, vector<string>> incompatible_final_cmake_args(const final_
 
 // stores, adds and removes and queries the list of packages and corresponding files
 // installed into a directory
+// The installdb directories are read only once per process, all instances share an in-memory
+// index which is updated together with the files. The installdb is either a directory of JSON
+// files or a binary snapshot and journal, see InstallDB::convert.
 class InstallDB
 {
 public:
@@ -41,6 +44,9 @@ public:
     // if incremental, the desc must be compatible with the currently installed desc
     void install_with_unspecified_files(installed_config_desc_t desc);  // taken by value
     void uninstall_config_if_installed(string_par pkg_name, const config_name_t& config);
+    // converts the local installdb to the binary format (a snapshot file and a journal) or to the
+    // JSON format (a file for each package and config), no-op if it's already in that format
+    void convert(bool to_binary);
 
     // checks if pkg_name is installed in this installdb or on any of the prefix paths
     // throws if it's installed in multiple directories
@@ -54,6 +60,10 @@ private:
     void put_installed_pkg_desc(installed_config_desc_t p);  // taken by value
     // void put_installed_pkg_files(string_par pkg_name, const pkg_files_t& p);
 
+    // reads the installed-config files, try_get_installed_pkg_all_configs caches the result
+    installed_pkg_configs_t load_installed_pkg_all_configs(string_par pkg_name,
+                                                           string_par prefix_path) const;
+
     // if prefix path is empty, returns local installdb
     vector<string> glob_installed_pkg_config_descs(string_par pkg_name,
                                                    string_par prefix_path) const;
@@ -68,6 +78,10 @@ private:
 };
 
 string calc_sha(const installed_config_desc_t& x);
+
+// the files and directories making up the installdb of an install prefix in either format,
+// including the ones which don't exist
+vector<string> installdb_files(string_par prefix_path);
 }
 
 #endif
@@ -0,0 +1,135 @@
+#include "jobserver.h"
+
+#include <cerrno>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
+
+#include <adasworks/sx/check.h>
+
+#include "filesystem.h"
+#include "misc_utils.h"
+#include "print.h"
+
+namespace cmakex {
+
+namespace fs = filesystem;
+
+jobserver_t* jobserver_t::instance = nullptr;
+
+jobserver_token_t::jobserver_token_t() : jobserver(jobserver_t::instance)
+{
+    if (!jobserver)
+        return;
+    token = jobserver->acquire_token();
+    env_["MAKEFLAGS"] = jobserver->makeflags;
+}
+
+jobserver_token_t::~jobserver_token_t()
+{
+    if (jobserver)
+        jobserver->release_token(token);
+}
+
+#ifdef _WIN32
+jobserver_t::jobserver_t(string_par dir, int n)
+{
+    log_warn("The '--jobserver' option is not supported on Windows, ignored.");
+}
+
+jobserver_t::~jobserver_t()
+{
+}
+
+char jobserver_t::acquire_token()
+{
+    return '+';
+}
+
+void jobserver_t::release_token(char)
+{
+}
+#else
+jobserver_t::jobserver_t(string_par dir, int n)
+{
+    CHECK(n > 0);
+    fs::create_directories(dir.c_str());
+    fifo_path = stringf("%s/jobserver-%d", dir.c_str(), (int)getpid());
+    unlink(fifo_path.c_str());  // leftover from a crashed run with the same pid
+    if (mkfifo(fifo_path.c_str(), 0600) != 0)
+        throwf_errno("Can't create the jobserver FIFO %s", path_for_log(fifo_path).c_str());
+
+    // the read end must be opened first (non-blocking), otherwise opening the write end blocks
+    read_fd = open(fifo_path.c_str(), O_RDONLY | O_NONBLOCK);
+    if (read_fd >= 0)
+        write_fd = open(fifo_path.c_str(), O_WRONLY);
+    if (read_fd < 0 || write_fd < 0) {
+        int e = errno;
+        if (read_fd >= 0)
+            close(read_fd);
+        unlink(fifo_path.c_str());
+        errno = e;
+        throwf_errno("Can't open the jobserver FIFO %s", path_for_log(fifo_path).c_str());
+    }
+
+    // each client has an implicit token, jobserver_token_t reserves it from the pool so the pool
+    // has all the n tokens
+    string tokens(n, '+');
+    if (!tokens.empty() &&
+        write(write_fd, tokens.data(), tokens.size()) != (ssize_t)tokens.size()) {
+        int e = errno;
+        close(write_fd);
+        close(read_fd);
+        unlink(fifo_path.c_str());
+        errno = e;
+        throwf_errno("Can't write the tokens into the jobserver FIFO %s",
+                     path_for_log(fifo_path).c_str());
+    }
+
+    makeflags = stringf("-j%d --jobserver-auth=fifo:%s", n, fifo_path.c_str());
+    CHECK(!instance);
+    instance = this;
+    log_info("Using jobserver with %d jobs for the native build tools.", n);
+    log_verbose("MAKEFLAGS=%s", makeflags.c_str());
+}
+
+jobserver_t::~jobserver_t()
+{
+    instance = nullptr;
+    close(write_fd);
+    close(read_fd);
+    unlink(fifo_path.c_str());
+}
+
+char jobserver_t::acquire_token()
+{
+    // the read end is non-blocking, the clients may take the token between poll() and read()
+    for (;;) {
+        char token;
+        auto r = read(read_fd, &token, 1);
+        if (r == 1)
+            return token;
+        if (r < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+            throwf_errno("Can't read the jobserver FIFO %s", path_for_log(fifo_path).c_str());
+        pollfd p;
+        p.fd = read_fd;
+        p.events = POLLIN;
+        p.revents = 0;
+        if (poll(&p, 1, -1) < 0 && errno != EINTR)
+            throwf_errno("Can't wait for the jobserver FIFO %s", path_for_log(fifo_path).c_str());
+    }
+}
+
+void jobserver_t::release_token(char token)
+{
+    while (write(write_fd, &token, 1) < 0 && errno == EINTR) {
+    }
+}
+#endif
+}
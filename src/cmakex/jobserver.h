@@ -0,0 +1,62 @@
+#ifndef JOBSERVER_29384729
+#define JOBSERVER_29384729
+
+#include "exec_process.h"
+#include "using-decls.h"
+
+namespace cmakex {
+
+// GNU make jobserver shared by all the cmake --build processes started by cmakex.
+//
+// Creates a named pipe (FIFO) holding n job tokens. The build steps pass it in MAKEFLAGS
+// ("-j<n> --jobserver-auth=fifo:<path>") to their cmake --build processes only (see
+// jobserver_token_t), so make (4.4 and later) and ninja (1.13 and later) take their jobs from a
+// single pool. A FIFO is used instead of an anonymous pipe because the file descriptors are not
+// inherited by the processes we launch.
+// Not supported on Windows, there it only logs a warning.
+class jobserver_t
+{
+public:
+    jobserver_t(string_par dir, int n);  // the FIFO is created in `dir`
+    ~jobserver_t();                      // removes the FIFO
+
+    jobserver_t(const jobserver_t&) = delete;
+    jobserver_t& operator=(const jobserver_t&) = delete;
+
+private:
+    friend class jobserver_token_t;
+
+    char acquire_token();  // blocks until a token is available
+    void release_token(char token);
+
+    static jobserver_t* instance;  // the running jobserver, if any
+
+    string fifo_path;
+    string makeflags;
+    int read_fd = -1;
+    int write_fd = -1;
+};
+
+// Held while a native build tool runs. Each client of the jobserver runs one job without taking a
+// token (the implicit token), this reserves a token for that job so all the clients together run
+// at most n jobs. Does nothing if there's no jobserver.
+class jobserver_token_t
+{
+public:
+    jobserver_token_t();   // blocks until a token is available
+    ~jobserver_token_t();  // returns the token
+
+    jobserver_token_t(const jobserver_token_t&) = delete;
+    jobserver_token_t& operator=(const jobserver_token_t&) = delete;
+
+    // MAKEFLAGS for the environment of the native build tool, empty if there's no jobserver
+    const exec_process_env_t& env() const { return env_; }
+
+private:
+    jobserver_t* jobserver;
+    char token = 0;
+    exec_process_env_t env_;
+};
+}
+
+#endif
@@ -0,0 +1,126 @@
+#include "log_command.h"
+
+#include <regex>
+
+#include <Poco/Glob.h>
+
+#include "cmakex_utils.h"
+#include "filesystem.h"
+#include "log_writer.h"
+#include "misc_utils.h"
+#include "print.h"
+
+namespace cmakex {
+
+namespace fs = filesystem;
+
+namespace {
+// a pattern matches the file name with or without the extensions
+bool log_matches(string_par path, string_par pattern)
+{
+    Poco::Glob globber(pattern.str());
+    return globber.match(fs::path(path.c_str()).filename().string()) ||
+           globber.match(log_name(path));
+}
+}
+
+int run_log_command(int argc, char* argv[])
+{
+    string binary_dir = ".";
+    string grep;
+    bool errors = false;
+    vector<string> patterns;
+    for (int argix = 2; argix < argc; ++argix) {
+        string arg = argv[argix];
+        if (arg == "-V")
+            continue;  // verbose flag processed earlier
+        if (arg == "-B") {
+            if (++argix >= argc)
+                badpars_exit("Missing path after '-B'");
+            binary_dir = argv[argix];
+        } else if (starts_with(arg, "-B"))
+            binary_dir = make_string(butleft(arg, 2));
+        else if (starts_with(arg, "--grep=")) {
+            grep = make_string(butleft(arg, strlen("--grep=")));
+            if (grep.empty())
+                badpars_exit("Missing regular expression after '--grep='");
+        } else if (arg == "--errors")
+            errors = true;
+        else if (!starts_with(arg, '-'))
+            patterns.emplace_back(arg);
+        else
+            badpars_exit(stringf("Invalid option for 'cmakex log': '%s'", arg.c_str()));
+    }
+
+    if (errors && !grep.empty())
+        badpars_exit("'--errors' and '--grep' can't be used together");
+
+    auto log_dir = cmakex_config_t(binary_dir).cmakex_log_dir();
+    auto all_files = log_files(log_dir);
+    if (patterns.empty() && grep.empty() && !errors) {
+        for (auto& f : all_files)
+            printf("%s\n", fs::path(f).filename().c_str());
+        return EXIT_SUCCESS;
+    }
+
+    vector<string> files;
+    if (patterns.empty())
+        files = all_files;
+    for (auto& p : patterns) {
+        bool found = false;
+        for (auto& f : all_files) {
+            if (log_matches(f, p)) {
+                found = true;
+                if (!is_one_of(f, files))
+                    files.emplace_back(f);
+            }
+        }
+        if (!found) {
+            log_error("No log matches '%s' in %s.", p.c_str(), path_for_log(log_dir).c_str());
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (errors) {
+        for (auto& f : files) {
+            auto name = fs::path(f).filename().string();
+            for_each_error_line(f, [&name, &files](int64_t line_number, const string& line) {
+                if (files.size() > 1)
+                    printf("%s:%lld:%s\n", name.c_str(), (long long)line_number, line.c_str());
+                else
+                    printf("%lld:%s\n", (long long)line_number, line.c_str());
+            });
+        }
+        return EXIT_SUCCESS;
+    }
+
+    std::regex re;
+    if (!grep.empty()) {
+        try {
+            re = std::regex(grep, std::regex::extended);
+        } catch (const exception& e) {
+            badpars_exit(stringf("Invalid regular expression '%s': %s", grep.c_str(), e.what()));
+        }
+    }
+    bool grep_found = false;
+    for (auto& f : files) {
+        auto name = fs::path(f).filename().string();
+        if (grep.empty() && files.size() > 1)
+            printf("==> %s <==\n", name.c_str());
+        LogReader reader(f);
+        string line;
+        while (reader.getline(line)) {
+            if (grep.empty())
+                printf("%s\n", line.c_str());
+            else if (std::regex_search(line, re)) {
+                grep_found = true;
+                if (files.size() > 1)
+                    printf("%s:%s\n", name.c_str(), line.c_str());
+                else
+                    printf("%s\n", line.c_str());
+            }
+        }
+    }
+    return grep.empty() || grep_found ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+}
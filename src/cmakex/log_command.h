@@ -0,0 +1,11 @@
+#ifndef LOG_COMMAND_4019283746
+#define LOG_COMMAND_4019283746
+
+namespace cmakex {
+
+// `cmakex log [-B <build-dir>] [--grep=<regex>|--errors] [<log>...]`: lists, prints or searches
+// the logs of a build dir, decompressing them as needed. Returns the exit code.
+int run_log_command(int argc, char* argv[]);
+}
+
+#endif
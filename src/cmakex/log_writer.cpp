@@ -0,0 +1,541 @@
+#include "log_writer.h"
+
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <iterator>
+#include <mutex>
+
+#include <nowide/fstream.hpp>
+
+#include <Poco/DeflatingStream.h>
+#include <Poco/DirectoryIterator.h>
+#include <Poco/File.h>
+#include <Poco/InflatingStream.h>
+
+#include "cmakex-types.h"
+#include "filesystem.h"
+#include "misc_utils.h"
+#include "print.h"
+
+namespace cmakex {
+
+namespace fs = filesystem;
+
+bool g_compress_logs = false;
+int g_logs_to_keep = 1;
+
+static const char* const k_gz_extension = ".gz";
+static const char* const k_index_extension = ".idx";
+static const char k_index_magic[] = "cmakex-log-index-1\n";
+// the log starts with the command line and the start time
+static const int k_log_header_lines = 2;
+
+string log_file_extension()
+{
+    return string(k_log_extension) + (g_compress_logs ? k_gz_extension : "");
+}
+
+namespace {
+// path of the log of a step, `i` runs before the current one
+string rotated_log_path(string_par log_dir, string_par step, int i, bool compressed)
+{
+    return stringf("%s/%s%s%s%s", log_dir.c_str(), step.c_str(),
+                   i == 0 ? "" : stringf(".%d", i).c_str(), k_log_extension,
+                   compressed ? k_gz_extension : "");
+}
+
+void rotate_logs(string_par log_dir, string_par step)
+{
+    const int keep = std::max(1, g_logs_to_keep);
+    // remove the oldest ones, also the ones kept by an earlier, larger g_logs_to_keep
+    for (int i = keep - 1;; ++i) {
+        bool found = false;
+        for (bool compressed : {false, true}) {
+            auto p = rotated_log_path(log_dir, step, i, compressed);
+            for (auto& x : {p, p + k_index_extension}) {
+                if (fs::is_regular_file(x)) {
+                    fs::remove(x);
+                    found = true;
+                }
+            }
+        }
+        if (!found && i >= keep)
+            break;
+    }
+    for (int i = keep - 2; i >= 0; --i) {
+        for (bool compressed : {false, true}) {
+            auto p = rotated_log_path(log_dir, step, i, compressed);
+            auto q = rotated_log_path(log_dir, step, i + 1, compressed);
+            if (fs::is_regular_file(p))
+                fs::rename(p, q);
+            if (fs::is_regular_file(p + k_index_extension))
+                fs::rename(p + k_index_extension, q + k_index_extension);
+        }
+    }
+}
+}
+
+namespace {
+// The index next to the log has a record for each line of the output (all the lines but the
+// header and the end time): the length of the line (so the offset of the line is the sum of the
+// previous ones), the difference of its time (in milliseconds) from the time of the previous line
+// and a byte of the source and the error flag. The numbers are in LEB128, zigzag-encoded if signed.
+// A record takes 4 bytes for a typical line.
+enum : uint8_t
+{
+    k_index_source_mask = 3,
+    k_index_error_flag = 4
+};
+
+void append_varint(string& s, uint64_t x)
+{
+    while (x >= 0x80) {
+        s.push_back((char)(x | 0x80));
+        x >>= 7;
+    }
+    s.push_back((char)x);
+}
+
+bool read_varint(const string& s, size_t& pos, uint64_t& x)
+{
+    x = 0;
+    for (int shift = 0; pos < s.size() && shift < 64; shift += 7) {
+        auto b = (uint8_t)s[pos++];
+        x |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+
+struct index_record_t
+{
+    int64_t offset, size;
+    uint8_t flags;
+};
+
+// the records of the complete lines of the log, nothing if there's no index
+maybe<vector<index_record_t>> read_log_index(string_par log_path)
+{
+    string index_path = log_path.str() + k_index_extension;
+    if (!fs::is_regular_file(index_path))
+        return nothing;
+    nowide::ifstream f(index_path.c_str(), std::ios_base::in | std::ios_base::binary);
+    string s((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+    const size_t magic_size = sizeof(k_index_magic) - 1;
+    if (s.compare(0, magic_size, k_index_magic) != 0)
+        return nothing;
+    size_t pos = magic_size;
+    uint64_t offset;
+    if (!read_varint(s, pos, offset))
+        return nothing;
+    // the log and the index are flushed separately, the last records may be missing from either
+    const int64_t log_size = ends_with(log_path.str(), k_gz_extension)
+                                 ? INT64_MAX
+                                 : (int64_t)Poco::File(log_path.str()).getSize();
+    vector<index_record_t> r;
+    for (;;) {
+        uint64_t size, dt;
+        if (!read_varint(s, pos, size) || !read_varint(s, pos, dt) || pos >= s.size())
+            break;
+        uint8_t flags = s[pos++];
+        if ((int64_t)(offset + size) > log_size)
+            break;
+        r.emplace_back(index_record_t{(int64_t)offset, (int64_t)size, flags});
+        offset += size;
+    }
+    return just(move(r));
+}
+}
+
+bool is_error_line(array_view<const char> line)
+{
+    // compiler, linker, cmake, make and ninja errors
+    static const char* const patterns[] = {"error:",      "Error:",        "ERROR:",
+                                           ": error ",    "fatal error",   "undefined reference",
+                                           "CMake Error", "make: ***",     "] Error ",
+                                           "FAILED:",     "ninja: build stopped"};
+    for (auto p : patterns) {
+        if (std::search(line.begin(), line.end(), p, p + strlen(p)) != line.end())
+            return true;
+    }
+    return false;
+}
+
+void for_each_error_line(string_par path, const std::function<void(int64_t, const string&)>& f)
+{
+    auto index = read_log_index(path);
+    if (!index) {
+        // no index: written by an earlier version or it couldn't be created
+        LogReader reader(path);
+        string line;
+        for (int64_t line_number = 1; reader.getline(line); ++line_number) {
+            if (line_number > k_log_header_lines &&
+                (starts_with(line, '!') ||
+                 is_error_line(array_view<const char>(line.data(), line.size()))))
+                f(line_number, line);
+        }
+        return;
+    }
+    auto selected = [](const index_record_t& x) {
+        return (x.flags & k_index_source_mask) == out_err_message_base_t::source_stderr ||
+               (x.flags & k_index_error_flag);
+    };
+    auto& records = *index;
+    if (ends_with(path.str(), k_gz_extension)) {
+        // can't seek in the compressed stream, it's decompressed but only the selected lines
+        // are looked at
+        LogReader reader(path);
+        string line;
+        int64_t line_number = 1;
+        for (auto& x : records) {
+            int64_t x_line_number = k_log_header_lines + 1 + (&x - records.data());
+            if (!selected(x))
+                continue;
+            for (; line_number <= x_line_number; ++line_number) {
+                if (!reader.getline(line))
+                    return;
+            }
+            f(x_line_number, line);
+        }
+        return;
+    }
+    nowide::ifstream file(path.c_str(), std::ios_base::in | std::ios_base::binary);
+    if (!file.good())
+        throwf("Can't open %s for reading.", path_for_log(path).c_str());
+    string line;
+    for (auto& x : records) {
+        if (!selected(x))
+            continue;
+        line.resize(x.size);
+        file.seekg(x.offset);
+        if (!file.read(&line[0], x.size))
+            return;
+        while (!line.empty() && (line.back() == '\n' || line.back() == '\r'))
+            line.pop_back();
+        f(k_log_header_lines + 1 + (&x - records.data()), line);
+    }
+}
+
+vector<string> log_files(string_par log_dir)
+{
+    vector<string> r;
+    if (!fs::is_directory(log_dir.c_str()))
+        return r;
+    for (Poco::DirectoryIterator it(log_dir.str()); it != Poco::DirectoryIterator(); ++it) {
+        if (!it->isFile())
+            continue;
+        auto& name = it.name();
+        if (ends_with(name, k_log_extension) ||
+            ends_with(name, string(k_log_extension) + k_gz_extension))
+            r.emplace_back(it.path().toString());
+    }
+    std::sort(BEGINEND(r));
+    return r;
+}
+
+string log_name(string_par path)
+{
+    auto name = fs::path(path.c_str()).filename().string();
+    for (auto e : {k_gz_extension, k_log_extension}) {
+        if (ends_with(name, e))
+            name.resize(name.size() - strlen(e));
+    }
+    return name;
+}
+
+struct LogReader::impl_t
+{
+    explicit impl_t(string_par path) : file(path.c_str(), std::ios_base::in | std::ios_base::binary)
+    {
+        if (!file.good())
+            throwf("Can't open %s for reading.", path_for_log(path).c_str());
+        if (ends_with(path.str(), k_gz_extension)) {
+            inflater.reset(
+                new Poco::InflatingInputStream(file, Poco::InflatingStreamBuf::STREAM_GZIP));
+            in = inflater.get();
+        } else
+            in = &file;
+    }
+    nowide::ifstream file;
+    std::unique_ptr<Poco::InflatingInputStream> inflater;
+    std::istream* in;
+};
+
+LogReader::LogReader(string_par path) : impl(new impl_t(path)) {}
+
+LogReader::~LogReader() {}
+
+bool LogReader::getline(string& line)
+{
+    // a log being written or cut short (cmakex was killed) has no gzip trailer, what could be
+    // decompressed is returned
+    try {
+        if (!std::getline(*impl->in, line))
+            return false;
+    } catch (...) {
+        return false;
+    }
+    if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+    return true;
+}
+
+struct LogWriter::log_file_t
+{
+    explicit log_file_t(string_par path)
+        : file(path.c_str(), std::ios_base::out | std::ios_base::trunc | std::ios_base::binary),
+          index((path.str() + k_index_extension).c_str(),
+                std::ios_base::out | std::ios_base::trunc | std::ios_base::binary)
+    {
+        if (!file.good())
+            return;
+        if (ends_with(path.str(), k_gz_extension)) {
+            deflater.reset(
+                new Poco::DeflatingOutputStream(file, Poco::DeflatingStreamBuf::STREAM_GZIP));
+            out = deflater.get();
+        } else
+            out = &file;
+    }
+    void close()
+    {
+        if (deflater)
+            deflater->close();
+        file.close();
+        index.close();
+    }
+    void flush()
+    {
+        out->flush();
+        index.flush();
+    }
+    nowide::ofstream file;
+    std::unique_ptr<Poco::DeflatingOutputStream> deflater;
+    std::ostream* out = nullptr;
+    nowide::ofstream index;  // see read_log_index
+    int64_t last_t_ms = 0;
+    string index_record;
+};
+
+LogWriter::LogWriter(string_par command_line,
+                     string_par log_dir,
+                     string_par log_filename,
+                     pipe_mode_t stdout_mode,
+                     pipe_mode_t stderr_mode)
+    : stdout_mode(stdout_mode),
+      stderr_mode(stderr_mode),
+      start_time(msg_clock::now()),
+      start_system_time(system_clock::now()),
+      end_system_time(start_system_time),
+      last_flush_time(start_time)
+{
+    string step = log_filename.str();
+    if (ends_with(step, k_log_extension))
+        step.resize(step.size() - strlen(k_log_extension));
+    log_path = rotated_log_path(log_dir, step, 0, g_compress_logs);
+    if (!fs::is_directory(log_dir.c_str())) {
+        string msg;
+        try {
+            fs::create_directories(log_dir.c_str());
+        } catch (const exception& e) {
+            msg = e.what();
+        } catch (...) {
+            msg = "unknown exception";
+        }
+        if (!msg.empty()) {
+            log_error("Can't create directory for logs (%s), reason: %s.",
+                      path_for_log(log_dir).c_str(), msg.c_str());
+            return;
+        }
+    }
+    try {
+        rotate_logs(log_dir, step);
+    } catch (const exception& e) {
+        log_warn("Can't rotate the logs of %s, reason: %s", step.c_str(), e.what());
+    }
+    f.reset(new log_file_t(log_path));
+    if (!f->out) {
+        log_error_errno("Can't open log file for writing: %s", path_for_log(log_path).c_str());
+        f.reset();
+        return;
+    }
+    auto header = stringf("%s\nStarted at %s\n", command_line.c_str(),
+                          datetime_string_for_log(start_system_time).c_str());
+    f->out->write(header.c_str(), header.size());
+    if (f->index.good()) {
+        f->index << k_index_magic;
+        append_varint(f->index_record, header.size());
+        f->index.write(f->index_record.data(), f->index_record.size());
+    }
+    f->flush();
+}
+
+LogWriter::~LogWriter()
+{
+    try {
+        finish(false);
+    } catch (...) {
+    }
+}
+
+exec_process_output_callback_t LogWriter::stdout_callback()
+{
+    if (stdout_mode == pipe_echo)
+        return {};
+    return [this](array_view<const char> x) {
+        add_output(out_err_message_base_t::source_stdout, x);
+        if (stdout_mode == pipe_echo_and_capture)
+            exec_process_callbacks::print_to_stdout(x);
+    };
+}
+
+exec_process_output_callback_t LogWriter::stderr_callback()
+{
+    if (stderr_mode == pipe_echo)
+        return {};
+    return [this](array_view<const char> x) {
+        add_output(out_err_message_base_t::source_stderr, x);
+        if (stderr_mode == pipe_echo_and_capture)
+            exec_process_callbacks::print_to_stderr(x);
+    };
+}
+
+// a message (the chunks up to and including the one ending with line feed) gets a single
+// timestamp, CR/LF runs break the lines and at most one empty line is kept from a run of line feeds
+void LogWriter::add_output(source_t source, array_view<const char> x)
+{
+    const char c_line_feed = 10;
+    const char c_carriage_return = 13;
+    std::lock_guard<atomic_flag_mutex> lock(mutex);
+    auto& s = source == out_err_message_base_t::source_stdout ? stdout_state : stderr_state;
+    if (!s.in_message) {
+        s.in_message = true;
+        s.t = std::chrono::duration<double>(msg_clock::now() - start_time).count();
+        s.indent = -1;
+        s.newline_count = 0;
+    }
+    for (auto c : x) {
+        if (c == c_line_feed || c == c_carriage_return) {
+            if (!s.line.empty())
+                write_line(source, s);
+            if (c == c_line_feed)
+                ++s.newline_count;
+        } else {
+            end_newline_run(source, s);
+            s.line.push_back(c);
+        }
+    }
+    if (!x.empty() && x.end()[-1] == c_line_feed) {
+        end_newline_run(source, s);
+        s.in_message = false;
+    }
+    flush();
+}
+
+void LogWriter::flush()
+{
+    if (!f)
+        return;
+    // a flush of the compressed stream ends the deflate block, too frequent flushes would spoil
+    // the compression
+    auto now = msg_clock::now();
+    if (f->deflater && now - last_flush_time < std::chrono::seconds(1))
+        return;
+    last_flush_time = now;
+    f->flush();
+}
+
+void LogWriter::write_line(source_t source, source_state_t& s)
+{
+    const char* stderr_marker = source == out_err_message_base_t::source_stdout ? " " : "!";
+    string prefix;
+    if (s.indent < 0) {
+        prefix = stringf("%s[%.2f] ", stderr_marker, s.t);
+        s.indent = prefix.size();
+    } else
+        prefix = stderr_marker + string(s.indent - 1, ' ');
+    if (line_callback)
+        line_callback(source, array_view<const char>(s.line.data(), s.line.size()));
+    put(prefix + s.line + "\n", source, s.t,
+        is_error_line(array_view<const char>(s.line.data(), s.line.size())));
+    s.line.clear();
+}
+
+void LogWriter::end_newline_run(source_t source, source_state_t& s)
+{
+    if (s.newline_count > 1)
+        put(source == out_err_message_base_t::source_stderr ? "!\n" : "\n", source, s.t, false);
+    s.newline_count = 0;
+}
+
+void LogWriter::put(string_par s, source_t source, double t, bool error)
+{
+    if (f) {
+        f->out->write(s.c_str(), s.size());
+        if (f->index.good()) {
+            auto& r = f->index_record;
+            r.clear();
+            int64_t t_ms = llround(t * 1000);
+            int64_t dt = t_ms - f->last_t_ms;
+            f->last_t_ms = t_ms;
+            append_varint(r, s.size());
+            append_varint(r, dt < 0 ? ((uint64_t)(-(dt + 1)) << 1) | 1 : (uint64_t)dt << 1);
+            r.push_back((char)(source | (error ? k_index_error_flag : 0)));
+            f->index.write(r.data(), r.size());
+        }
+    }
+    if ((int)tail.size() < c_tail_capacity)
+        tail.emplace_back(s.str());
+    else
+        tail[line_count % c_tail_capacity] = s.str();
+    ++line_count;
+}
+
+void LogWriter::finish(bool also_to_stdout)
+{
+    std::lock_guard<atomic_flag_mutex> lock(mutex);
+    if (finished)
+        return;
+    finished = true;
+    end_system_time = system_clock::now();
+    for (auto source :
+         {out_err_message_base_t::source_stdout, out_err_message_base_t::source_stderr}) {
+        auto& s = source == out_err_message_base_t::source_stdout ? stdout_state : stderr_state;
+        if (!s.line.empty())
+            write_line(source, s);
+        end_newline_run(source, s);
+    }
+    auto finished_line =
+        stringf("Finished at %s\n", datetime_string_for_log(end_system_time).c_str());
+    bool saved = false;
+    if (f) {
+        *f->out << finished_line;
+        try {
+            f->close();
+            saved = true;
+        } catch (const exception& e) {
+            log_error("Can't write log file %s, reason: %s", path_for_log(log_path).c_str(),
+                      e.what());
+        }
+        f.reset();
+    }
+
+    if (!also_to_stdout)
+        return;
+    printf("Started at %s\n", datetime_string_for_log(start_system_time).c_str());
+    int64_t first_line = std::max<int64_t>(0, line_count - (int64_t)tail.size());
+    if (first_line > 0)
+        printf("... (%d lines omitted, see the log)\n", (int)first_line);
+    for (auto i = first_line; i < line_count; ++i)
+        printf("%s", tail[i % c_tail_capacity].c_str());
+    printf("%s", finished_line.c_str());
+    if (saved)
+        log_info("Log saved to %s.", path_for_log(log_path).c_str());
+}
+
+double LogWriter::duration() const
+{
+    return std::chrono::duration<double>(end_system_time - start_system_time).count();
+}
+}
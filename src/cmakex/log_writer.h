@@ -0,0 +1,130 @@
+#ifndef LOG_WRITER_2038475610
+#define LOG_WRITER_2038475610
+
+#include <chrono>
+#include <functional>
+#include <memory>
+
+#include "out_err_messages.h"
+#include "using-decls.h"
+
+namespace cmakex {
+
+extern bool g_compress_logs;  // write the logs gzip-compressed
+extern int g_logs_to_keep;    // number of logs kept for each step, including the current one
+
+// ".log" or ".log.gz", depending on g_compress_logs
+string log_file_extension();
+
+// The logs of a step are `<step>.log` (the last one), `<step>.1.log` (the one before), etc.., with
+// the `.gz` extension if compressed. Before a new log of a step is written the older ones are
+// shifted and the ones over g_logs_to_keep are removed.
+
+// the logs in the log dir, sorted by name
+vector<string> log_files(string_par log_dir);
+
+// name of the log file without the directory and the `.log` and `.gz` extensions
+string log_name(string_par path);
+
+// true if the line looks like an error of the compiler, linker, cmake, make or ninja
+bool is_error_line(array_view<const char> line);
+
+// Calls `f` with the line number (1-based) and the text of the stderr lines and the lines looking
+// like errors of a log. A sidecar index (`<log>.idx`, written by LogWriter) tells where these
+// lines are so only they are read from an uncompressed log. Without the index the whole log is
+// scanned.
+void for_each_error_line(string_par path, const std::function<void(int64_t, const string&)>& f);
+
+// reads a log file, decompresses it if it's compressed
+class LogReader
+{
+public:
+    explicit LogReader(string_par path);  // throws if the file can't be opened
+    ~LogReader();
+    // the next line without the line ending, false at the end of the log
+    bool getline(string& line);
+
+private:
+    struct impl_t;
+    std::unique_ptr<impl_t> impl;
+};
+
+// Writes the output of a child process to a log file as it arrives. Each line is prefixed with a
+// stderr marker ('!' for stderr, ' ' for stdout) and the time of the message since the start, the
+// continuation lines of a message are indented instead. The file is flushed after each chunk (at
+// most once a second if compressed) so the log survives if cmakex is killed. Only the last lines
+// are kept in memory, they're printed to the console if the process fails.
+class LogWriter
+{
+public:
+    using source_t = out_err_message_base_t::source_t;
+    // called with each line of the output (without the line ending), while the output is being
+    // received
+    using line_callback_t = std::function<void(source_t, array_view<const char>)>;
+
+    // creates the directory, rotates the older logs of the step, creates the file and writes the
+    // command line and the start time. If it fails it logs an error and the output will be kept
+    // only in the tail. `log_filename` has the `.log` extension, it's replaced by
+    // log_file_extension().
+    LogWriter(string_par command_line,
+              string_par log_dir,
+              string_par log_filename,
+              pipe_mode_t stdout_mode,
+              pipe_mode_t stderr_mode);
+    ~LogWriter();
+
+    exec_process_output_callback_t stdout_callback();
+    exec_process_output_callback_t stderr_callback();
+
+    // must be set before the process is launched
+    void set_line_callback(line_callback_t f) { line_callback = move(f); }
+
+    // writes the unfinished lines and the end time and closes the file. If also_to_stdout prints
+    // the tail of the log and the path of the log file. The destructor calls it if it hasn't
+    // been called.
+    void finish(bool also_to_stdout);
+
+    // seconds between the construction and finish()
+    double duration() const;
+
+private:
+    using msg_clock = std::chrono::steady_clock;
+    using system_clock = std::chrono::system_clock;
+
+    struct source_state_t
+    {
+        bool in_message = false;  // the last chunk hasn't ended with line feed
+        double t = 0;             // time of the current message since start_time
+        int indent = -1;          // -1 until the first line of the current message is written
+        int newline_count = 0;    // line feeds since the last line written
+        string line;              // newline-free section received so far
+    };
+
+    void add_output(source_t source, array_view<const char> x);
+    void write_line(source_t source, source_state_t& s);
+    void end_newline_run(source_t source, source_state_t& s);
+    void put(string_par s, source_t source, double t, bool error);
+    void flush();
+
+    struct log_file_t;
+
+    static const int c_tail_capacity = 100;
+
+    const pipe_mode_t stdout_mode, stderr_mode;
+    string log_path;
+    std::unique_ptr<log_file_t> f;
+    const msg_clock::time_point start_time;
+    const system_clock::time_point start_system_time;
+    system_clock::time_point end_system_time;
+    msg_clock::time_point last_flush_time;
+    bool finished = false;
+    line_callback_t line_callback;
+    source_state_t stdout_state, stderr_state;
+    // ring buffer of the last c_tail_capacity lines written
+    vector<string> tail;
+    int64_t line_count = 0;
+    atomic_flag_mutex mutex;
+};
+}
+
+#endif
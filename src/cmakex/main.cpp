@@ -1,6 +1,7 @@
 #include <nowide/args.hpp>
 
 #include <cmath>
+#include <memory>
 
 #include <nowide/cstdlib.hpp>
 #include <nowide/cstdio.hpp>
@@ -9,16 +10,22 @@
 
 #include <adasworks/sx/check.h>
 
+#include "clone.h"
 #include "cmakex_utils.h"
 #include "filesystem.h"
 #include "git.h"
 #include "helper_cmake_project.h"
 #include "install_deps_phase_one.h"
 #include "install_deps_phase_two.h"
+#include "installdb.h"
+#include "jobserver.h"
+#include "log_command.h"
 #include "misc_utils.h"
+#include "package_repository.h"
 #include "print.h"
 #include "process_command_line.h"
 #include "run_cmake_steps.h"
+#include "run_fingerprint.h"
 #include "cmakex_utils.h"
 
 namespace cmakex {
@@ -52,6 +59,11 @@ int main(int argc, char* argv[])
         if (clg)
             g_log_git = eval_cmake_boolean_or_fail(clg);
     }
+    {
+        auto gmd = nowide::getenv("CMAKEX_GIT_MIRROR_DIR");
+        if (gmd && strlen(gmd) > 0)
+            enable_git_mirrors(fs::absolute(gmd).string());
+    }
     {
         // using default-cmakex-preset.yaml in the application's dir, if needed
         auto exe_path = fs::path(get_executable_path(argv[0])).parent_path().string();
@@ -115,6 +127,8 @@ int main(int argc, char* argv[])
     FILE* manifest_handle = nullptr;
 
     try {
+        if (argc >= 2 && strcmp(argv[1], "log") == 0)
+            return run_log_command(argc, argv);
         auto cla = process_command_line_1(argc, argv);
         if (cla.subcommand.empty())
             exit(EXIT_SUCCESS);
@@ -123,6 +137,12 @@ int main(int argc, char* argv[])
 
         tie(pars, cmakex_cache) = process_command_line_2(cla);
 
+        // one pool of job tokens for all the native build tool processes we launch
+        std::unique_ptr<jobserver_t> jobserver;
+        if (pars.jobserver_jobs > 0)
+            jobserver.reset(new jobserver_t(cmakex_config_t(pars.binary_dir).cmakex_tmp_dir(),
+                                            pars.jobserver_jobs));
+
         // cmakex_cache may contain new data to the stored cmakex_cache, or
         // in case of a first cmakex call on this binary dir, it is not saved at all
         // We'll save it on the first successful configuration: either after configuring the
@@ -138,7 +158,60 @@ int main(int argc, char* argv[])
                                             path_for_log(pars.manifest).c_str()));
         }
 
-        if (pars.deps_mode != dm_main_only) {
+        // the no-op fast path: skip the dependencies if nothing they depend on has changed since
+        // the last run, unless this run has been asked for more than bringing them up to date
+        bool use_run_fingerprint = pars.deps_mode != dm_main_only && !pars.force_build &&
+                                   pars.update_mode == update_mode_none &&
+                                   !pars.clear_downloaded_include_files &&
+                                   pars.installdb_format == installdb_format_unchanged &&
+                                   !manifest_handle;
+        string run_context;
+        bool deps_up_to_date = false;
+        if (use_run_fingerprint) {
+            run_context = run_fingerprint_context(argc, argv);
+            deps_up_to_date = run_fingerprint_matches(pars.binary_dir, run_context);
+            if (deps_up_to_date)
+                log_info("Dependencies are up to date, nothing has changed since the last run.");
+        }
+
+        if (pars.deps_mode != dm_main_only && !deps_up_to_date) {
+            clear_run_fingerprint(pars.binary_dir);
+            string binary_cache_dir = pars.binary_cache_dir;
+            if (binary_cache_dir.empty()) {
+                auto e = nowide::getenv("CMAKEX_BINARY_CACHE_DIR");
+                if (e)
+                    binary_cache_dir = e;
+            }
+            if (!binary_cache_dir.empty()) {
+                binary_cache_dir = fs::absolute(binary_cache_dir).string();
+                fs::create_directories(binary_cache_dir);
+            }
+            string package_repository = pars.package_repository;
+            if (package_repository.empty()) {
+                auto e = nowide::getenv("CMAKEX_PACKAGE_REPOSITORY");
+                if (e)
+                    package_repository = e;
+            }
+            if (pars.package_source_policy != package_source_local_build) {
+                if (package_repository.empty())
+                    badpars_exit(
+                        "The package source policy needs a package repository, use "
+                        "'--package-repository' or set CMAKEX_PACKAGE_REPOSITORY");
+                if (!is_package_repository_url(package_repository))
+                    package_repository = fs::absolute(package_repository).string();
+                if (pars.force_build &&
+                    pars.package_source_policy == package_source_force_server_build)
+                    badpars_exit("'--force-build' can't be used with 'force_server_build'");
+            }
+            if (pars.ls_remote_cache_ttl > 0) {
+                if (pars.update_mode == update_mode_none)
+                    enable_ls_remote_disk_cache(
+                        cmakex_config_t(pars.binary_dir).cmakex_dir() + "/ls_remote_cache",
+                        pars.ls_remote_cache_ttl);
+                else
+                    log_info("Not using the ls-remote cache because of '--update'.");
+            }
+
             deps_recursion_wsp_t wsp;
             wsp.force_build = pars.force_build;
             wsp.clear_downloaded_include_files = pars.clear_downloaded_include_files;
@@ -191,13 +264,28 @@ int main(int argc, char* argv[])
             // been validated and fixed so we're writing out the cmakex cache
             write_cmakex_cache_if_dirty(pars.binary_dir, cmakex_cache);
 
+            if (pars.installdb_format != installdb_format_unchanged)
+                InstallDB(pars.binary_dir)
+                    .convert(pars.installdb_format == installdb_format_binary);
+
             fs::create_directories(cmakex_config_t(pars.binary_dir).find_module_hijack_dir());
 
             string ds = pars.deps_script;
             if (!ds.empty() && fs::is_regular_file(ds))
                 ds = fs::lexically_normal(fs::absolute(ds));
-            install_deps_phase_one(pars.binary_dir, pars.source_dir, {}, command_line_cmake_args,
-                                   configs, wsp, cmakex_cache, ds);
+            {
+                // clones the dependencies in the background while the recursion is processing
+                // the dependency scripts
+                std::unique_ptr<clone_prefetcher_t> clone_prefetcher;
+                if (pars.clone_jobs > 1) {
+                    clone_prefetcher.reset(
+                        new clone_prefetcher_t(pars.binary_dir, pars.clone_jobs));
+                    wsp.clone_prefetcher = clone_prefetcher.get();
+                }
+                install_deps_phase_one(pars.binary_dir, pars.source_dir, {},
+                                       command_line_cmake_args, configs, wsp, cmakex_cache, ds);
+                wsp.clone_prefetcher = nullptr;
+            }
 #if 0
             for (auto& kv : wsp.pkg_map) {
                 auto& pkg_name = kv.first;
@@ -217,11 +305,17 @@ int main(int argc, char* argv[])
             }
 #endif
             install_deps_phase_two(pars.binary_dir, wsp, !pars.cmake_args.empty() || pars.flag_c,
-                                   pars.build_args, pars.native_tool_args);
+                                   pars.build_args, pars.native_tool_args, pars.pkg_jobs,
+                                   pars.parallel_configs, binary_cache_dir,
+                                   pars.package_source_policy, package_repository);
             log_info("%d dependenc%s %s been processed.", (int)wsp.pkg_map.size(),
                      wsp.pkg_map.size() == 1 ? "y" : "ies",
                      wsp.pkg_map.size() == 1 ? "has" : "have");
             log_info();
+            if (use_run_fingerprint)
+                save_run_fingerprint(pars.binary_dir, run_context, keys_of_map(wsp.pkg_map),
+                                     concat(cmakex_cache.cmakex_prefix_path_vector,
+                                            cmakex_cache.env_cmakex_prefix_path_vector));
             if (manifest_handle) {
                 fprintf(manifest_handle, "#### DEPENDENCIES ####\n\n");
                 for (auto& kv : wsp.pkg_map) {
@@ -315,9 +409,8 @@ int main(int argc, char* argv[])
                     OutErrMessages oem(oeb.move_result());
                     for (int i = 0; i < oem.size(); ++i) {
                         auto msg = oem.at(i);
-                        auto lines = split_at_newlines(msg.text);
-                        for (auto& l : lines)
-                            remote_lines += stringf("#     %s\n", l.c_str());
+                        for (auto l : split_lines(msg.text))
+                            remote_lines += stringf("#     %s\n", make_string(l).c_str());
                     }
                 } catch (const exception& e) {
                     remote_lines = stringf("# Can't get git remote, reason: %s\n", e.what());
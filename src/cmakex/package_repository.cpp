@@ -0,0 +1,142 @@
+#include "package_repository.h"
+
+#include <Poco/Process.h>
+
+#include "filesystem.h"
+#include "misc_utils.h"
+#include "out_err_messages.h"
+#include "print.h"
+
+namespace cmakex {
+
+namespace fs = filesystem;
+
+static const char* const k_download_script =
+    "file(DOWNLOAD \"${URL}\" \"${FILE}\" STATUS s)\n"
+    "list(GET s 0 c)\n"
+    "if(NOT c EQUAL 0)\n"
+    "  file(REMOVE \"${FILE}\")\n"
+    "  list(GET s 1 m)\n"
+    "  message(FATAL_ERROR \"${m}\")\n"
+    "endif()\n";
+
+bool is_package_repository_url(string_par repository)
+{
+    return strstr(repository.c_str(), "://") != nullptr;
+}
+
+namespace {
+string archive_in_repository(string_par repository, string_par pkg_name, string_par key)
+{
+    return stringf("%s/%s/%s.tar.gz", repository.c_str(), pkg_name.c_str(), key.c_str());
+}
+
+string pid_suffix()
+{
+    return stringf(".tmp-%ld", (long)Poco::Process::id());
+}
+
+// runs cmake with args, throws with cmake's stderr on failure
+void exec_cmake_or_throw(const vector<string>& args, string_par working_directory)
+{
+    OutErrMessagesBuilder oeb(pipe_capture, pipe_capture);
+    int r = exec_process("cmake", args, working_directory, oeb.stdout_callback(),
+                         oeb.stderr_callback());
+    if (r == EXIT_SUCCESS)
+        return;
+    auto oem = oeb.move_result();
+    string stderr_text;
+    for (int i = 0; i < oem.size(); ++i) {
+        auto msg = oem.at(i);
+        if (msg.source == out_err_message_base_t::source_stderr)
+            stderr_text.append(msg.text.begin(), msg.text.end());
+    }
+    throwf("'cmake %s' failed with %d: %s", join(args, " ").c_str(), r,
+           strip_trailing_whitespace(stderr_text).c_str());
+}
+}
+
+bool fetch_from_package_repository(string_par repository,
+                                   string_par pkg_name,
+                                   string_par key,
+                                   string_par cache_dir,
+                                   string_par tmp_dir)
+{
+    string archive = archive_in_repository(repository, pkg_name, key);
+    string entry_dir = cache_dir.str() + "/" + key.str();
+    string unpack_dir = entry_dir + pid_suffix();
+    string downloaded;
+    bool ok = false;
+    try {
+        if (is_package_repository_url(repository)) {
+            fs::create_directories(tmp_dir.c_str());
+            downloaded = stringf("%s/%s%s.tar.gz", tmp_dir.c_str(), key.c_str(),
+                                 pid_suffix().c_str());
+            string script = tmp_dir.str() + "/cmakex_download" + pid_suffix() + ".cmake";
+            {
+                auto f = must_fopen(script, "w");
+                must_fprintf(f, "%s", k_download_script);
+            }
+            try {
+                exec_cmake_or_throw({"-DURL=" + archive, "-DFILE=" + downloaded, "-P", script},
+                                    "");
+            } catch (...) {
+                fs::remove(script);
+                throw;
+            }
+            fs::remove(script);
+            archive = downloaded;
+        } else if (!fs::is_regular_file(archive))
+            return false;
+        fs::create_directories(unpack_dir);
+        exec_cmake_or_throw({"-E", "tar", "xzf", archive}, unpack_dir);
+        fs::rename(unpack_dir, entry_dir);
+        ok = true;
+    } catch (const exception& e) {
+        log_warn("Can't fetch %s from the package repository, reason: %s",
+                 pkg_for_log(pkg_name).c_str(), e.what());
+    }
+    for (auto& x : {downloaded, unpack_dir}) {
+        if (!x.empty() && fs::exists(x)) {
+            try {
+                fs::remove_all(x);
+            } catch (...) {
+            }
+        }
+    }
+    // a concurrent fetch may have won the rename
+    return ok || fs::exists(entry_dir);
+}
+
+void publish_to_package_repository(string_par repository,
+                                   string_par pkg_name,
+                                   string_par key,
+                                   string_par cache_dir)
+{
+    if (is_package_repository_url(repository)) {
+        log_warn("Can't publish %s, the package repository %s is not a directory.",
+                 pkg_for_log(pkg_name).c_str(), repository.c_str());
+        return;
+    }
+    string archive = archive_in_repository(repository, pkg_name, key);
+    string entry_dir = cache_dir.str() + "/" + key.str();
+    if (fs::exists(archive) || !fs::is_directory(entry_dir))
+        return;
+    string tmp_archive = archive + pid_suffix();
+    try {
+        fs::create_directories(fs::path(archive).parent_path());
+        exec_cmake_or_throw({"-E", "tar", "czf", tmp_archive, "."}, entry_dir);
+        fs::rename(tmp_archive, archive);
+        log_info("Published %s into the package repository.", pkg_for_log(pkg_name).c_str());
+    } catch (const exception& e) {
+        log_warn("Can't publish %s into the package repository, reason: %s",
+                 pkg_for_log(pkg_name).c_str(), e.what());
+        if (fs::exists(tmp_archive)) {
+            try {
+                fs::remove(tmp_archive);
+            } catch (...) {
+            }
+        }
+    }
+}
+}
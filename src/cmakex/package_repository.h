@@ -0,0 +1,30 @@
+#ifndef PACKAGE_REPOSITORY_09823745
+#define PACKAGE_REPOSITORY_09823745
+
+#include "using-decls.h"
+
+namespace cmakex {
+
+// A package repository holds binary cache entries (see binary_cache.h) as archives, at
+// <repository>/<pkg_name>/<key>.tar.gz. The repository is either a local (or network mounted)
+// directory or a URL any file server can serve (anything CMake's file(DOWNLOAD) can fetch).
+// Publishing is supported only for directories.
+
+bool is_package_repository_url(string_par repository);
+
+// downloads and unpacks the archive into the binary cache dir as the entry `key`
+// returns false if the repository has no such archive or it can't be fetched (logs a warning)
+bool fetch_from_package_repository(string_par repository,
+                                   string_par pkg_name,
+                                   string_par key,
+                                   string_par cache_dir,
+                                   string_par tmp_dir);
+
+// packs the binary cache entry `key` into the repository, failure is only logged
+void publish_to_package_repository(string_par repository,
+                                   string_par pkg_name,
+                                   string_par key,
+                                   string_par cache_dir);
+}
+
+#endif
@@ -1,18 +1,26 @@
 #include "print.h"
 
+#include <mutex>
+
 #include <nowide/cstdio.hpp>
 
+#include <adasworks/sx/mutex.h>
+
 #include <Poco/DateTimeFormat.h>
 #include <Poco/DateTimeFormatter.h>
 #include <Poco/Timezone.h>
 
-#include "filesystem.h"
 #include "misc_utils.h"
-#include "out_err_messages.h"
 
 namespace cmakex {
 
-namespace fs = filesystem;
+using adasworks::sx::atomic_flag_mutex;
+using lock_guard = std::lock_guard<atomic_flag_mutex>;
+
+namespace {
+// keeps the lines printed from parallel package builds intact
+atomic_flag_mutex s_print_mutex;
+}
 
 bool g_verbose = false;
 bool g_log_git = false;
@@ -20,6 +28,7 @@ bool g_supress_deps_cmake_logs = false;
 
 void log_info()
 {
+    lock_guard lock(s_print_mutex);
     printf("--\n");
     fflush(stdout);
 }
@@ -28,6 +37,7 @@ void log_verbose(const char* s, ...)
 {
     if (!g_verbose)
         return;
+    lock_guard lock(s_print_mutex);
     printf("-- ");
     va_list ap;
     va_start(ap, s);
@@ -39,6 +49,7 @@ void log_verbose(const char* s, ...)
 
 void log_info(const char* s, ...)
 {
+    lock_guard lock(s_print_mutex);
     printf("-- ");
     va_list ap;
     va_start(ap, s);
@@ -57,6 +68,7 @@ void log_info_framed_message(string_par msg)
 
 void log_warn(const char* s, ...)
 {
+    lock_guard lock(s_print_mutex);
     printf("-- WARNING: ");
     va_list ap;
     va_start(ap, s);
@@ -68,6 +80,7 @@ void log_warn(const char* s, ...)
 
 void log_error(const char* s, ...)
 {
+    lock_guard lock(s_print_mutex);
     fprintf(stderr, "cmakex: ERROR: ");
     va_list ap;
     va_start(ap, s);
@@ -77,6 +90,7 @@ void log_error(const char* s, ...)
 }
 void log_fatal(const char* s, ...)
 {
+    lock_guard lock(s_print_mutex);
     fprintf(stderr, "cmakex: [FATAL] ");
     va_list ap;
     va_start(ap, s);
@@ -87,6 +101,7 @@ void log_fatal(const char* s, ...)
 void log_error_errno(const char* s, ...)
 {
     int was_errno = errno;
+    lock_guard lock(s_print_mutex);
     fprintf(stderr, "cmakex: [ERROR]");
     va_list ap;
     va_start(ap, s);
@@ -145,6 +160,7 @@ string string_exec(string_par command, const vector<string>& args, string_par wo
 string log_exec(string_par command, const vector<string>& args, string_par working_directory)
 {
     auto r = string_exec(command, args, working_directory);
+    lock_guard lock(s_print_mutex);
     printf("%s\n", r.c_str());
     fflush(stdout);
     return r;
@@ -167,120 +183,6 @@ string datetime_string_for_log(std::chrono::system_clock::time_point x)
     return datetime_string_for_log(dt);
 }
 
-struct slf_helper_t
-{
-    slf_helper_t(bool also_to_stdout, FILE* f) : also_to_stdout(also_to_stdout), f(f) {}
-    bool also_to_stdout;
-    FILE* f;
-};
-
-void slf_printf(slf_helper_t& h, string_par s)
-{
-    fprintf(h.f, "%s", s.c_str());
-    if (h.also_to_stdout)
-        printf("%s", s.c_str());
-}
-
-void slf_printf_file_only(slf_helper_t& h, string_par s)
-{
-    fprintf(h.f, "%s", s.c_str());
-}
-
-void save_log_from_oem(string_par command_line,
-                       bool also_to_stdout,
-                       const OutErrMessages& oem,
-                       string_par log_dir,
-                       string_par log_filename)
-{
-#ifdef _MSC_VER
-    _set_printf_count_output(1);
-#endif
-
-    if (!fs::is_directory(log_dir.c_str())) {
-        string msg;
-        try {
-            fs::create_directories(log_dir.c_str());
-        } catch (const exception& e) {
-            msg = e.what();
-        } catch (...) {
-            msg = "unknown exception";
-        }
-        if (!msg.empty()) {
-            log_error("Can't create directory for logs (%s), reason: %s.",
-                      path_for_log(log_dir).c_str(), msg.c_str());
-            return;
-        }
-    }
-    string log_path = log_dir.str() + "/" + log_filename.c_str();
-    auto maybe_f = try_fopen(log_path, "w");
-    if (!maybe_f) {
-        log_error_errno("Can't open log file for writing: %s", path_for_log(log_path).c_str());
-        return;
-    }
-    auto f = move(*maybe_f);
-
-    slf_helper_t h(also_to_stdout, f.stream());
-
-    slf_printf_file_only(h, stringf("%s\n", command_line.c_str()));
-    slf_printf(
-        h, stringf("Started at %s\n", datetime_string_for_log(oem.start_system_time()).c_str()));
-    const char c_line_feed = 10;
-    const char c_carriage_return = 13;
-    const int c_stderr_marker_length = 1;
-    // longest timestamp must fit into c_spaces
-    //                      [12345678901.23]
-    const char* c_spaces = "                                ";
-    for (int i = 0; i < oem.size(); ++i) {
-        auto msg = oem.at(i);
-        int xs = msg.text.size();
-        int x0 = 0;
-        int indent = -1;
-        const char* stderr_marker = msg.source == out_err_message_base_t::source_stdout ? " " : "!";
-        assert(c_stderr_marker_length == strlen(stderr_marker));
-        for (; x0 < xs;) {
-            int x1 = x0;
-            // find the next newline-free section
-            while (x1 < xs && msg.text[x1] != c_line_feed && msg.text[x1] != c_carriage_return)
-                ++x1;
-            // print the newline-free section
-            if (x0 < x1) {
-                if (indent < 0)
-                    slf_printf(h, stringf("%s[%.2f] %n%.*s\n", stderr_marker, msg.t, &indent,
-                                          x1 - x0, msg.text.c_str() + x0));
-                else {
-                    assert(indent - c_stderr_marker_length <= strlen(c_spaces));
-                    slf_printf(
-                        h, stringf("%s%.*s%.*s\n", stderr_marker, indent - c_stderr_marker_length,
-                                   c_spaces, x1 - x0, msg.text.c_str() + x0));
-                }
-            }
-            // find the next newline section
-            int newline_count = 0;
-            for (; x1 < xs; ++x1) {
-                auto c = msg.text[x1];
-                if (c == c_line_feed)
-                    ++newline_count;
-                else if (c != c_carriage_return)
-                    break;
-            }
-            // print at most one extra newline
-            if (newline_count > 1) {
-                if (msg.source == out_err_message_base_t::source_stderr)
-                    slf_printf(h, stringf("%s\n", stderr_marker));
-                else
-                    slf_printf(h, "\n");
-            }
-
-            x0 = x1;
-        }
-    }
-    slf_printf(h,
-               stringf("Finished at %s\n", datetime_string_for_log(oem.end_system_time()).c_str()));
-
-    if (also_to_stdout)
-        log_info("Log saved to %s.", /*prefix_msg.c_str(), */ path_for_log(log_path).c_str());
-}
-
 void log_datetime()
 {
     log_info("%s", current_datetime_string_for_log().c_str());
@@ -1,6 +1,7 @@
 #ifndef PRINT_8327683
 #define PRINT_8327683
 
+#include <chrono>
 #include <cstdarg>
 #include <cstdio>
 
@@ -9,8 +10,6 @@
 
 namespace cmakex {
 
-class OutErrMessages;
-
 extern bool g_verbose;
 extern bool g_log_git;
 extern bool g_supress_deps_cmake_logs;
@@ -30,17 +29,9 @@ string string_exec(string_par command,
 string log_exec(string_par command, const vector<string>& args, string_par working_directory = "");
 string current_datetime_string_for_log();
 
-// saves log from oem to specified location and prints informational message
-// if result!=EXIT_SUCCESS also prints to console
-void save_log_from_oem(string_par command_line,
-                       bool also_to_stdout,
-                       const OutErrMessages& oem,
-                       string_par log_dir,
-                       string_par log_filename);
-
 // string datetime_string_for_log(Poco::DateTime dt);
 string current_datetime_string_for_log();
-// string datetime_string_for_log(std::chrono::system_clock::time_point x);
+string datetime_string_for_log(std::chrono::system_clock::time_point x);
 void log_datetime();
 }
 
@@ -1,12 +1,17 @@
 #include "filesystem.h"
 
+#include <climits>
+#include <cstdlib>
+
 #include <adasworks/sx/check.h>
 
 #include "cmakex_utils.h"
 #include "getpreset.h"
+#include "log_writer.h"
 #include "misc_utils.h"
 #include "print.h"
 #include "process_command_line.h"
+#include "run_fingerprint.h"
 
 namespace cmakex {
 
@@ -23,6 +28,7 @@ Usage: cmakex [--help] [--version]
               [c][b][i][t][d][r][w] [<source/build-dir-spec]
               [<cmake-args>...] [<additional-args>...]
               [-- <native-build-tool-args>...]
+       cmakex log [-B <build-dir>] [--grep=<regex>|--errors] [<log>...]
 
 For brief help, use `--help`
 For detailed help, see README.md
@@ -36,6 +42,7 @@ Usage: cmakex [--help] [--version]
               [c][b][i][t][d][r][w] [<source/build-dir-spec]
               [<cmake-args>...] [<additional-args>...]
               [-- <native-build-tool-args>...]
+       cmakex log [-B <build-dir>] [--grep=<regex>|--errors] [<log>...]
 
 For detailed help, see README.md
 Note: Invoke CTest is not yet implemented.
@@ -102,7 +109,11 @@ Package-management
                   Before executing the cmake-steps on the main project, process
                   the dependency-script at <source-dir>/deps.cmake (default) or
                   at <path> and download/configure/build/install the packages
-                  defined in the script (on demand)
+                  defined in the script (on demand).
+                  If nothing has changed since the last run (command line,
+                  environment, dependency scripts, changes in the clones,
+                  installed packages) the dependencies are not processed at
+                  all.
 
     --deps-only[=<path>]
                   Same as `--deps` but does not process the main project.
@@ -173,12 +184,124 @@ Miscellaneous
               stderr from cmake will only be saved to disk but not forwarded to
               stdout, except if the command fails.
 
+    --log-compression=gzip|none
+              Write the logs of the cmake steps (in the `_cmakex/log`
+              directory of the build) gzip-compressed. Default: `none`.
+
+    --keep-logs=<n>
+              Keep the logs of the last <n> runs of each step. The last one is
+              `<step>.log`, the ones before it are `<step>.1.log`,
+              `<step>.2.log`, etc.. (`.log.gz` if compressed). Default: 1.
+
+    -j <n>, --pkg-jobs <n>, --pkg-jobs=<n>
+              Build at most <n> dependencies in parallel. A dependency is
+              started as soon as all the dependencies it depends on have been
+              installed. Implies `-q`. On failure no new dependencies are
+              started, the ones already installed are kept. The dependencies
+              heading the longest chains of builds (using the step durations
+              recorded in the previous runs) are started first.
+
+    --parallel-configs
+              Configure and build the configurations (Debug, Release, etc..)
+              of a project at the same time. Effective only with per-config
+              build directories (see `--single-build-dir`). The cmake output
+              is saved to the log files only. With `-j <n>` at most <n>
+              configure/build steps are running at the same time.
+
+    --jobserver <n>, --jobserver=<n>
+              Run a GNU make jobserver with <n> job tokens shared by all the
+              native build tool processes (dependencies and main project,
+              built in parallel or not): at most <n> jobs run at the same
+              time, including the first job of each build. Only the build
+              steps get the jobserver in MAKEFLAGS. Requires GNU make 4.4 or
+              Ninja 1.13 (or later). Don't pass `-j` to the native build tool
+              after `--` when using this option. Not supported on Windows.
+
+    --clone-jobs <n>, --clone-jobs=<n>
+              Clone at most <n> dependencies in parallel, in the background,
+              as soon as they are added by a dependency script. The output of
+              the background clones is mixed with the rest of the output.
+              Default: 1, the dependencies are cloned one by one, when they
+              are processed.
+
+    --ls-remote-cache=<seconds>
+              Save the results of `git ls-remote` under the `_cmakex`
+              directory of the build and reuse them in the next runs for
+              <seconds>. Within a single run each remote is queried only once
+              anyway. Not used with `--update`.
+
+    --binary-cache=<dir>
+              Machine-wide cache of built dependencies, can be shared by
+              any number of build directories. A configuration of a
+              dependency built with the same commit, cmake args,
+              generator, compilers and dependencies is copied from the
+              cache into the install directory instead of being configured
+              and built. Each newly built configuration is added to the
+              cache unless one of its installed files contains the path of
+              the install directory.
+              Default: the `CMAKEX_BINARY_CACHE_DIR` environment variable.
+
+    --package-source-policy=<policy>
+              Where the dependencies come from. With `local_build` (default)
+              they're always built here. The other policies look up prebuilt
+              archives in the package repository first (see
+              `--package-repository`), matched by commit, cmake args and
+              dependencies like with `--binary-cache`. On a miss
+              `try_server_build` builds the dependency here, `server_build`
+              also publishes the result into the repository (directories
+              only) and `force_server_build` stops with an error.
+
+    --package-repository=<dir-or-url>
+              Package repository for `--package-source-policy`: a directory
+              or a URL of a file server, the archives are looked up at
+              `<dir-or-url>/<package-name>/<fingerprint>.tar.gz`.
+              Default: the `CMAKEX_PACKAGE_REPOSITORY` environment variable.
+
+    --installdb-format=json|binary
+              Converts the database of the installed dependencies (in the
+              `_cmakex` directory of the install prefix) to the given format.
+              `json` (default) is a file for each package and config,
+              `binary` is a single snapshot file and an append-only journal
+              which are faster to load and update. Convert back to `json`
+              to inspect the contents.
+
 Environment variables
 ---------------------
 
     CMAKEX_LOG_GIT=<cmake-recognized-boolean-value>
               If enabled, logs all git commands to stdout. For debugging.
 
+    CMAKEX_BINARY_CACHE_DIR=<dir>
+              Default value for `--binary-cache`.
+
+    CMAKEX_PACKAGE_REPOSITORY=<dir-or-url>
+              Default value for `--package-repository`.
+
+    CMAKEX_GIT_MIRROR_DIR=<dir>
+              Shared store of bare git mirrors, one per repository URL. The
+              dependencies are cloned with `--reference` to the mirror, which
+              is created on first use and fetched once per run, so each
+              repository is downloaded and stored only once for all build
+              directories. The mirrors are fetched without pruning and never
+              garbage collected so they keep every object the clones use.
+              The clones need the mirrors: don't remove the directory while
+              the clones referencing it are in use.
+
+
+Logs
+====
+
+    cmakex log [-B <build-dir>] [--grep=<regex>|--errors] [<log>...]
+              Without arguments lists the logs of the build directory
+              (default: current directory). Prints the logs matching the
+              <log> patterns (file names, with or without the extensions,
+              wildcards allowed), decompressing them if needed. With
+              `--grep` prints only the lines matching the extended regular
+              expression, from all the logs if no <log> is given. With
+              `--errors` prints the stderr lines and the lines looking like
+              compiler, linker, cmake, make or ninja errors, with their line
+              numbers. An index written next to each log is used to find these
+              lines without reading the whole log.
 
 cmakex configuration
 ====================
@@ -253,6 +376,34 @@ fs::path strip_trailing_dot(const fs::path& x)
     return x;
 }
 
+int parse_positive_int_or_badpars(string_par s, string_par option)
+{
+    char* end = nullptr;
+    long r = strtol(s.c_str(), &end, 10);
+    if (s.empty() || *end != 0 || r < 1 || r > INT_MAX)
+        badpars_exit(stringf("Invalid number for '%s': '%s'", option.c_str(), s.c_str()));
+    return (int)r;
+}
+
+bool is_option_with_value(string_par option, const string& arg)
+{
+    return arg == option.c_str() || starts_with(arg, option.str() + "=");
+}
+
+// the number of `<option> <n>` (advances argix) or `<option>=<n>`
+int parse_count_option_or_badpars(string_par option,
+                                  const string& arg,
+                                  int argc,
+                                  char* argv[],
+                                  int& argix)
+{
+    if (arg != option.c_str())
+        return parse_positive_int_or_badpars(make_string(butleft(arg, option.size() + 1)), option);
+    if (++argix >= argc)
+        badpars_exit(stringf("Missing number after '%s'", arg.c_str()));
+    return parse_positive_int_or_badpars(argv[argix], option);
+}
+
 command_line_args_cmake_mode_t process_command_line_1(int argc, char* argv[])
 {
     command_line_args_cmake_mode_t pars;
@@ -342,6 +493,46 @@ command_line_args_cmake_mode_t process_command_line_1(int argc, char* argv[])
                 }
             } else if (arg == "--single-build-dir") {
                 pars.single_build_dir = true;
+            } else if (arg == "--parallel-configs") {
+                pars.parallel_configs = true;
+            } else if (is_option_with_value("--jobserver", arg)) {
+                pars.jobserver_jobs =
+                    parse_count_option_or_badpars("--jobserver", arg, argc, argv, argix);
+            } else if (starts_with(arg, "--ls-remote-cache=")) {
+                pars.ls_remote_cache_ttl = parse_positive_int_or_badpars(
+                    make_string(butleft(arg, strlen("--ls-remote-cache="))), "--ls-remote-cache");
+            } else if (starts_with(arg, "--binary-cache=")) {
+                pars.binary_cache_dir = make_string(butleft(arg, strlen("--binary-cache=")));
+                if (pars.binary_cache_dir.empty())
+                    badpars_exit("Missing directory after '--binary-cache='");
+            } else if (starts_with(arg, "--package-source-policy=")) {
+                string policy = make_string(butleft(arg, strlen("--package-source-policy=")));
+                if (policy == "local_build")
+                    pars.package_source_policy = package_source_local_build;
+                else if (policy == "try_server_build")
+                    pars.package_source_policy = package_source_try_server_build;
+                else if (policy == "server_build")
+                    pars.package_source_policy = package_source_server_build;
+                else if (policy == "force_server_build")
+                    pars.package_source_policy = package_source_force_server_build;
+                else
+                    badpars_exit(stringf("Invalid policy in '%s'", arg.c_str()));
+            } else if (starts_with(arg, "--package-repository=")) {
+                pars.package_repository =
+                    make_string(butleft(arg, strlen("--package-repository=")));
+                if (pars.package_repository.empty())
+                    badpars_exit("Missing directory or URL after '--package-repository='");
+            } else if (starts_with(arg, "--installdb-format=")) {
+                string format = make_string(butleft(arg, strlen("--installdb-format=")));
+                if (format == "json")
+                    pars.installdb_format = installdb_format_json;
+                else if (format == "binary")
+                    pars.installdb_format = installdb_format_binary;
+                else
+                    badpars_exit(stringf("Invalid format in '%s'", arg.c_str()));
+            } else if (is_option_with_value("--clone-jobs", arg)) {
+                pars.clone_jobs =
+                    parse_count_option_or_badpars("--clone-jobs", arg, argc, argv, argix);
             } else if (starts_with(arg, "-H")) {
                 if (arg == "-H") {
                     // unlike cmake, here we support the '-H <path>' style, too
@@ -404,6 +595,26 @@ command_line_args_cmake_mode_t process_command_line_1(int argc, char* argv[])
                     badpars_exit(stringf("Invalid mode in '%s'", arg.c_str()));
             } else if (arg == "-q") {
                 g_supress_deps_cmake_logs = true;
+            } else if (starts_with(arg, "--log-compression=")) {
+                string c = make_string(butleft(arg, strlen("--log-compression=")));
+                if (c == "gzip")
+                    g_compress_logs = true;
+                else if (c == "none")
+                    g_compress_logs = false;
+                else
+                    badpars_exit(stringf("Invalid compression in '%s'", arg.c_str()));
+            } else if (starts_with(arg, "--keep-logs=")) {
+                g_logs_to_keep = parse_positive_int_or_badpars(
+                    make_string(butleft(arg, strlen("--keep-logs="))), "--keep-logs");
+            } else if (is_option_with_value("--pkg-jobs", arg)) {
+                pars.pkg_jobs = parse_count_option_or_badpars("--pkg-jobs", arg, argc, argv, argix);
+            } else if (starts_with(arg, "-j")) {
+                // `-j <n>` or `-j<n>`
+                if (arg == "-j")
+                    pars.pkg_jobs = parse_count_option_or_badpars("-j", arg, argc, argv, argix);
+                else
+                    pars.pkg_jobs =
+                        parse_positive_int_or_badpars(make_string(butleft(arg, 2)), "-j");
             } else if (!starts_with(arg, '-')) {
                 pars.free_args.emplace_back(arg);
             } else {
@@ -481,6 +692,8 @@ tuple<processed_command_line_args_cmake_mode_t, cmakex_cache_t> process_command_
                 "the directory of the cmakex executable.",
                 msg.c_str(), default_cmakex_preset_filename());
         CHECK(!names.empty());
+        // the args of the presets are not on the command line
+        watch_file_for_run_fingerprint(file);
         if (names.size() == 1)
             log_info("Using preset `%s` from %s", names[0].c_str(), path_for_log(file).c_str());
         else
@@ -168,7 +168,15 @@ macro(include __CMAKEX_INCL_ARG0)
         endif()
     endif()
     if(NOT "${__CMAKEX_INCL_PATH}" MATCHES "^https?://")
-        _include("${__CMAKEX_INCL_PATH}" ${ARGN})
+        _include("${__CMAKEX_INCL_PATH}" ${__CMAKEX_INCL_EXTRA_ARG}
+            RESULT_VARIABLE __CMAKEX_INCL_INCLUDED)
+        if(__CMAKEX_INCL_ARG_RESULT_VARIABLE)
+            set("${__CMAKEX_INCL_ARG_RESULT_VARIABLE}" "${__CMAKEX_INCL_INCLUDED}")
+        endif()
+        # record the files the result depends on
+        if(__CMAKEX_INCL_INCLUDED AND __CMAKEX_INCLUDED_FILES_OUT)
+            file(APPEND "${__CMAKEX_INCLUDED_FILES_OUT}" "${__CMAKEX_INCL_INCLUDED}\n")
+        endif()
     else()
         set(__CMAKEX_INCL_DOWNLOAD_DIR "${CMAKE_CURRENT_BINARY_DIR}/downloaded_include_files")
         if(__CMAKEX_INCL_CLEAR_DOWNLOAD_DIR)
@@ -246,6 +254,9 @@ macro(include __CMAKEX_INCL_ARG0)
             # Maintain a stack for parent urls. It needs to be a stack because the same variable
             # will be updated by recursively called include() commands.
             list(APPEND __CMAKEX_INCL_PARENT_URL_STACK "${__CMAKEX_INCL_DIR}")
+            if(__CMAKEX_INCLUDED_FILES_OUT)
+                file(APPEND "${__CMAKEX_INCLUDED_FILES_OUT}" "${__CMAKEX_INCL_TEMP_FILE}\n")
+            endif()
             if(__CMAKEX_INCL_ARG_RESULT_VARIABLE)
                 set("${__CMAKEX_INCL_ARG_RESULT_VARIABLE}" "${__CMAKEX_INCL_PATH}")
             endif()
@@ -287,8 +298,21 @@ function(def_pkg NAME)
   file(APPEND "${__CMAKEX_ADD_PKG_OUT}" "${line}\n")
 endfunction()
 
-# include deps script within a function to protect local variables
-function(include_deps_script path)
+# include deps script within a function to protect local variables, the add_pkg/def_pkg lines go
+# to `out`, the paths of the included files to `included_files_out`
+function(include_deps_script path out included_files_out)
+  if(WIN32)
+      # file(TO_CMAKE_PATH is not good because it changes : -> ;
+      string(REPLACE "\\" "/" out "${out}")
+      string(REPLACE "\\" "/" included_files_out "${included_files_out}")
+  endif()
+  foreach(f IN ITEMS "${out}" "${included_files_out}")
+    if(NOT EXISTS "${f}" OR IS_DIRECTORY "${f}")
+      message(FATAL_ERROR "Internal error, the output file \"${f}\" is not an existing file.")
+    endif()
+  endforeach()
+  set(__CMAKEX_ADD_PKG_OUT "${out}")
+  set(__CMAKEX_INCLUDED_FILES_OUT "${included_files_out}")
   include("${path}")
 endfunction()
 
@@ -298,21 +322,33 @@ if(DEFINED command)
 
   if(verb STREQUAL "run")
     list(LENGTH command l)
-    if(NOT l EQUAL 3)
+    if(NOT l EQUAL 4)
       message(FATAL_ERROR "Internal error, invalid command")
     endif()
     list(GET command 1 path)
     list(GET command 2 out)
-    if(WIN32)
-        # file(TO_CMAKE_PATH is not good because it changes : -> ;
-        string(REPLACE "\\" "/" out "${out}")
-        string(REPLACE "\\" "/" out "${out}")
-    endif()
-    if(NOT EXISTS "${out}" OR IS_DIRECTORY "${out}")
-      message(FATAL_ERROR "Internal error, the output file \"${out}\" is not an existing file.")
+    list(GET command 3 included_files_out)
+    include_deps_script("${path}" "${out}" "${included_files_out}")
+  elseif(verb STREQUAL "run_batch")
+    # (package, script, out, included_files_out) quadruples
+    list(REMOVE_AT command 0)
+    list(LENGTH command l)
+    math(EXPR r "${l} % 4")
+    if(l EQUAL 0 OR NOT r EQUAL 0)
+      message(FATAL_ERROR "Internal error, invalid command")
     endif()
-    set(__CMAKEX_ADD_PKG_OUT "${out}")
-    include_deps_script("${path}")
+    math(EXPR last "${l} - 4")
+    foreach(i RANGE 0 ${last} 4)
+      math(EXPR i1 "${i} + 1")
+      math(EXPR i2 "${i} + 2")
+      math(EXPR i3 "${i} + 3")
+      list(GET command ${i} pkg)
+      list(GET command ${i1} path)
+      list(GET command ${i2} out)
+      list(GET command ${i3} included_files_out)
+      message(STATUS "Dependency script of ${pkg}: ${path}")
+      include_deps_script("${path}" "${out}" "${included_files_out}")
+    endforeach()
   endif()
 else()
   message(STATUS "No command specified.")
@@ -6,6 +6,8 @@
 #include "filesystem.h"
 
 #include "build.h"
+#include "build_slots.h"
+#include "cmakex_utils.h"
 #include "misc_utils.h"
 #include "out_err_messages.h"
 #include "print.h"
@@ -31,16 +33,31 @@ void run_cmake_steps(const processed_command_line_args_cmake_mode_t& pars,
         build_targets = {""};
 
     bool force_config_step_now = !pars.cmake_args.empty() || pars.flag_c;
-    for (auto& config_str : pars.configs) {
-        config_name_t config(config_str);
-        log_info("Building: '%s'", config.get_prefer_NoConfig().c_str());
-        build(pars.binary_dir, "", pars.source_dir, pars.cmake_args, config, build_targets,
-              force_config_step_now, cmakex_cache, pars.build_args, pars.native_tool_args);
+    if (pars.parallel_configs && cmakex_cache.per_config_bin_dirs && pars.configs.size() > 1) {
+        // separate binary dirs, the configurations can be configured and built at the same time
+        build_slots_t build_slots(pars.pkg_jobs > 1 ? pars.pkg_jobs : (int)pars.configs.size());
+        log_info("Building [%s] in parallel.", join(pars.configs, ", ").c_str());
+        run_with_build_slots(pars.configs.size(), build_slots, [&](int i) {
+            config_name_t config(pars.configs[i]);
+            log_info("Building: '%s'", config.get_prefer_NoConfig().c_str());
+            build(pars.binary_dir, "", pars.source_dir, pars.cmake_args, config, build_targets,
+                  force_config_step_now, cmakex_cache, pars.build_args, pars.native_tool_args,
+                  true);
+        });
+        // the threads don't write the cmakex cache, see build()
+        write_cmakex_cache_if_dirty(pars.binary_dir, cmakex_cache);
+    } else {
+        for (auto& config_str : pars.configs) {
+            config_name_t config(config_str);
+            log_info("Building: '%s'", config.get_prefer_NoConfig().c_str());
+            build(pars.binary_dir, "", pars.source_dir, pars.cmake_args, config, build_targets,
+                  force_config_step_now, cmakex_cache, pars.build_args, pars.native_tool_args);
 
-        if (cmakex_cache.multiconfig_generator)
-            force_config_step_now = false;
+            if (cmakex_cache.multiconfig_generator)
+                force_config_step_now = false;
 
-    }  // for configs
+        }  // for configs
+    }
     log_info("Finished at %s, elapsed %s", current_datetime_string_for_log().c_str(),
              sx::format_duration(dur_sec(high_resolution_clock::now() - main_tic).count()).c_str());
 }
@@ -0,0 +1,223 @@
+#include "run_fingerprint.h"
+
+#include <mutex>
+
+#include <nowide/cstdlib.hpp>
+
+#include <Poco/File.h>
+
+#include "cereal_utils.h"
+#include "cmakex_utils.h"
+#include "filesystem.h"
+#include "git.h"
+#include "git_refs.h"
+#include "installdb.h"
+#include "misc_utils.h"
+#include "print.h"
+
+namespace cmakex {
+struct watched_file_t
+{
+    string path;
+    int64_t size = -1;  // -1: doesn't exist, 0 for directories
+    int64_t mtime = 0;  // microseconds
+
+    bool operator==(const watched_file_t& y) const
+    {
+        return path == y.path && size == y.size && mtime == y.mtime;
+    }
+};
+
+struct run_fingerprint_t
+{
+    string context;
+    vector<watched_file_t> files;
+    vector<string> clone_dirs;  // their work trees must match their index
+};
+}
+
+CEREAL_CLASS_VERSION(cmakex::watched_file_t, 1)
+CEREAL_CLASS_VERSION(cmakex::run_fingerprint_t, 2)
+
+namespace cmakex {
+
+namespace fs = filesystem;
+
+#define A(X) cereal::make_nvp(#X, m.X)
+
+template <class Archive>
+void serialize(Archive& archive, watched_file_t& m, uint32_t version)
+{
+    THROW_UNLESS(version == 1);
+    archive(A(path), A(size), A(mtime));
+}
+
+template <class Archive>
+void serialize(Archive& archive, run_fingerprint_t& m, uint32_t version)
+{
+    THROW_UNLESS(version == 1 || version == 2);
+    archive(A(context), A(files));
+    if (version >= 2)
+        archive(A(clone_dirs));
+    else
+        m.context.clear();  // the work trees were not checked, never matches
+}
+
+#undef A
+
+static const char* const k_run_fingerprint_filename = "run_fingerprint.json";
+static const char* const cmakex_version_with_meta = STRINGIZE(CMAKEX_VERSION_WITH_META);
+
+namespace {
+std::mutex s_watched_files_mutex;
+std::map<string, watched_file_t> s_watched_files;
+
+string run_fingerprint_path(string_par binary_dir)
+{
+    return cmakex_config_t(binary_dir).cmakex_dir() + "/" + k_run_fingerprint_filename;
+}
+
+watched_file_t stat_file(string_par path)
+{
+    watched_file_t r;
+    r.path = path.str();
+    try {
+        Poco::File f(r.path);
+        if (f.exists()) {
+            r.size = f.isDirectory() ? 0 : (int64_t)f.getSize();
+            r.mtime = f.getLastModified().epochMicroseconds();
+        }
+    } catch (...) {
+        r.size = -1;
+    }
+    return r;
+}
+
+// the files git changes on checkout, commit, reset and when files are staged
+vector<string> clone_git_files(string_par clone_dir)
+{
+    string git_dir = clone_dir.str() + "/.git";
+    vector<string> r{git_dir + "/HEAD", git_dir + "/index", git_dir + "/packed-refs"};
+    auto head = git_dir + "/HEAD";
+    if (fs::is_regular_file(head)) {
+        auto lines = must_read_file_as_lines(head);
+        if (!lines.empty() && starts_with(lines[0], "ref: "))
+            r.emplace_back(git_dir + "/" + trim(make_string(butleft(lines[0], 5))));
+    }
+    return r;
+}
+}
+
+string run_fingerprint_context(int argc, char* argv[])
+{
+    string s = stringf("%s\n%s\n", cmakex_version_with_meta, fs::current_path().c_str());
+    for (int i = 1; i < argc; ++i)
+        s += stringf("%s\n", argv[i]);
+    for (auto v : {"PATH", "CMAKE_PREFIX_PATH", "CMAKEX_BINARY_CACHE_DIR", "CMAKEX_GIT_MIRROR_DIR",
+                   "CMAKEX_LOG_GIT", "CMAKEX_PACKAGE_REPOSITORY", "CMAKEX_PRESET_FILE", "CC", "CXX",
+                   "CFLAGS", "CXXFLAGS", "LDFLAGS", "CMAKE_GENERATOR", "CMAKE_GENERATOR_PLATFORM",
+                   "CMAKE_GENERATOR_TOOLSET", "CMAKE_TOOLCHAIN_FILE"}) {
+        auto e = nowide::getenv(v);
+        s += stringf("%s%s%s\n", v, e ? "=" : "", e ? e : "");
+    }
+    return string_sha(s);
+}
+
+bool run_fingerprint_matches(string_par binary_dir, string_par context)
+{
+    auto path = run_fingerprint_path(binary_dir);
+    if (!fs::is_regular_file(path))
+        return false;
+    run_fingerprint_t f;
+    try {
+        load_json_input_archive(path, f);
+    } catch (const exception& e) {
+        log_warn("Ignoring the fingerprint of the last run, reason: %s", e.what());
+        return false;
+    }
+    if (f.context != context.str())
+        return false;
+    for (auto& x : f.files) {
+        if (!(stat_file(x.path) == x)) {
+            log_verbose("Changed since the last run: %s", path_for_log(x.path).c_str());
+            return false;
+        }
+    }
+    // edits not yet staged are not visible in the git files
+    for (auto& d : f.clone_dirs) {
+        if (!git_work_tree_matches_index(d)) {
+            log_verbose("The work tree may have changed since the last run: %s",
+                        path_for_log(d).c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+void clear_run_fingerprint(string_par binary_dir)
+{
+    auto path = run_fingerprint_path(binary_dir);
+    if (fs::exists(path))
+        fs::remove(path);
+}
+
+void watch_file_for_run_fingerprint(string_par path)
+{
+    auto p = fs::lexically_normal(fs::absolute(path.c_str())).string();
+    std::lock_guard<std::mutex> lock(s_watched_files_mutex);
+    if (s_watched_files.count(p) == 0)
+        s_watched_files.emplace(p, stat_file(p));
+}
+
+void save_run_fingerprint(string_par binary_dir,
+                          string_par context,
+                          const vector<string>& pkgs,
+                          const vector<string>& prefix_paths)
+{
+    cmakex_config_t cfg(binary_dir);
+    InstallDB installdb(binary_dir);
+    for (auto& p : pkgs) {
+        // these are rebuilt in each run
+        for (auto& kv : installdb.try_get_installed_pkg_all_configs(p).config_descs) {
+            if (starts_with(kv.second.git_sha, k_installed_from_uncommitted_prefix)) {
+                log_verbose("Not saving the fingerprint of this run, '%s' has been installed "
+                            "from uncommitted changes.",
+                            p.c_str());
+                return;
+            }
+        }
+    }
+
+    run_fingerprint_t f;
+    f.context = context.str();
+    {
+        std::lock_guard<std::mutex> lock(s_watched_files_mutex);
+        for (auto& kv : s_watched_files)
+            f.files.emplace_back(kv.second);
+    }
+    for (auto& p : pkgs) {
+        auto clone_dir = cfg.pkg_clone_dir(p);
+        if (fs::exists(clone_dir + "/.git")) {
+            if (!git_work_tree_matches_index(clone_dir)) {
+                log_verbose(
+                    "Not saving the fingerprint of this run, the work tree of '%s' can't be "
+                    "quickly checked.",
+                    p.c_str());
+                return;
+            }
+            f.clone_dirs.emplace_back(clone_dir);
+        }
+        for (auto& x : clone_git_files(clone_dir))
+            f.files.emplace_back(stat_file(x));
+    }
+    for (auto& prefix : concat(vector<string>{cfg.deps_install_dir()}, prefix_paths)) {
+        for (auto& x : installdb_files(prefix))
+            f.files.emplace_back(stat_file(x));
+    }
+    try {
+        save_json_output_archive(run_fingerprint_path(binary_dir), f);
+    } catch (const exception& e) {
+        log_warn("Can't save the fingerprint of this run, reason: %s", e.what());
+    }
+}
+}
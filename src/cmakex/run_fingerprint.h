@@ -0,0 +1,40 @@
+#ifndef RUN_FINGERPRINT_20394857
+#define RUN_FINGERPRINT_20394857
+
+#include "using-decls.h"
+
+namespace cmakex {
+
+// No-op fast path of the runs processing the dependencies. A successful run saves a fingerprint of
+// its inputs in the cmakex dir: the command line and the environment, the dependency scripts and
+// the files they included, the HEAD and index of the clones, the installdbs, the -C and
+// toolchain files and the preset file. If the fingerprint is the same in the next run the
+// dependencies are known to be up to date and they're not processed at all.
+// Files are compared by size and modification time. The work trees of the clones are compared with
+// their index by the stat data recorded in the index, no fingerprint is saved or matched if that
+// can't tell (e.g. on Windows).
+
+// SHA of the command line, the working directory, the environment variables cmakex and cmake
+// depend on and the cmakex version
+string run_fingerprint_context(int argc, char* argv[]);
+
+// true if the fingerprint saved by the last run has the same context, none of the files recorded in
+// it has changed and the work trees of the clones match their index
+bool run_fingerprint_matches(string_par binary_dir, string_par context);
+
+// removes the saved fingerprint, a run that may change the dependencies must call it first
+void clear_run_fingerprint(string_par binary_dir);
+
+// records the current state of a file (or its absence) the dependencies depend on, the first call
+// for a path counts, thread-safe
+void watch_file_for_run_fingerprint(string_par path);
+
+// saves the fingerprint: the context, the files watched so far, the git files of the clones of
+// `pkgs` and the installdbs of the install dir of the dependencies and of the prefix paths
+void save_run_fingerprint(string_par binary_dir,
+                          string_par context,
+                          const vector<string>& pkgs,
+                          const vector<string>& prefix_paths);
+}
+
+#endif
@@ -0,0 +1,46 @@
+#include "step_durations.h"
+
+#include <mutex>
+
+#include "cereal_utils.h"
+#include "filesystem.h"
+#include "print.h"
+
+namespace cmakex {
+
+namespace fs = filesystem;
+
+namespace {
+std::mutex s_step_durations_mutex;
+}
+
+static const char* const k_step_durations_filename = "step_durations.json";
+
+step_durations_t load_step_durations(string_par log_dir)
+{
+    step_durations_t r;
+    string path = log_dir.str() + "/" + k_step_durations_filename;
+    if (!fs::is_regular_file(path))
+        return r;
+    try {
+        load_json_input_archive(path, r);
+    } catch (const exception& e) {
+        log_warn("Ignoring the durations of the previous builds, reason: %s", e.what());
+        r.clear();
+    }
+    return r;
+}
+
+void record_step_duration(string_par log_dir, string_par step, double seconds)
+{
+    std::lock_guard<std::mutex> lock(s_step_durations_mutex);
+    auto durations = load_step_durations(log_dir);
+    durations[step.str()] = seconds;
+    try {
+        fs::create_directories(log_dir.c_str());
+        save_json_output_archive(log_dir.str() + "/" + k_step_durations_filename, durations);
+    } catch (const exception& e) {
+        log_warn("Can't save the duration of %s, reason: %s", step.c_str(), e.what());
+    }
+}
+}
@@ -0,0 +1,21 @@
+#ifndef STEP_DURATIONS_20938472
+#define STEP_DURATIONS_20938472
+
+#include <map>
+
+#include "using-decls.h"
+
+namespace cmakex {
+
+// Wall-clock durations of the cmake steps of the previous runs, stored in the log dir. The steps
+// are identified by the name of their log file without the extension, like
+// "foo-Release-configure" or "foo-Release-build-install".
+using step_durations_t = std::map<string, double>;  // step -> seconds
+
+step_durations_t load_step_durations(string_par log_dir);
+
+// thread-safe, the file is updated immediately
+void record_step_duration(string_par log_dir, string_par step, double seconds);
+}
+
+#endif
@@ -3,6 +3,13 @@
 #include <cctype>
 #include <cerrno>
 
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 #include <Poco/SHA1Engine.h>
 #include <nowide/cstdio.hpp>
 
@@ -136,6 +143,34 @@ maybe<file_t> try_fopen(string_par path, string_par mode)
     return f ? just(file_t(f)) : nothing;
 }
 
+void must_fsync(const file_t& f, string_par path)
+{
+#ifdef _WIN32
+    int r = fflush(f.stream()) ? -1 : _commit(_fileno(f.stream()));
+#else
+    int r = fflush(f.stream()) ? -1 : fsync(fileno(f.stream()));
+#endif
+    if (r)
+        throwf_errno("Can't flush %s to the disk", path_for_log(path).c_str());
+}
+
+void must_fsync_dir(string_par dir)
+{
+#ifndef _WIN32
+    int fd = open(dir.c_str(), O_RDONLY);
+    if (fd < 0)
+        throwf_errno("Can't open directory %s", path_for_log(dir).c_str());
+    // some filesystems can't sync directories, nothing to do there
+    int r = fsync(fd);
+    int e = errno;
+    close(fd);
+    if (r && e != EINVAL) {
+        errno = e;
+        throwf_errno("Can't flush directory %s to the disk", path_for_log(dir).c_str());
+    }
+#endif
+}
+
 void must_fprintf(const file_t& f, const char* format, ...)
 {
     va_list ap;
@@ -387,6 +422,25 @@ vector<string> split_at_newlines(string text)
     text.erase(std::remove_if(BEGINEND(text), [](char c) { return c == '\r'; }), text.end());
     return split(text, '\n');
 }
+vector<array_view<const char>> split_lines(array_view<const char> x)
+{
+    vector<array_view<const char>> v;
+    if (x.empty())
+        return v;
+    auto b = x.begin();
+    for (auto it = x.begin();; ++it) {
+        if (it == x.end() || *it == '\n') {
+            auto e = it;
+            while (e != b && e[-1] == '\r')
+                --e;
+            v.emplace_back(b, e - b);
+            if (it == x.end())
+                break;
+            b = it + 1;
+        }
+    }
+    return v;
+}
 bool safe_fs_equivalent(string_par x, string_par y)
 {
     bool xe = fs::exists(x.c_str());
@@ -113,6 +113,11 @@ inline size_t fread(void* buffer, size_t size, size_t count, const file_t& f)
     return ::fread(buffer, size, count, f.stream());
 }
 
+// flushes the stream and the file's data to the disk, throws on failure
+void must_fsync(const file_t& f, string_par path);
+// flushes the entries of a directory to the disk (e.g. after a rename), no-op on Windows
+void must_fsync_dir(string_par dir);
+
 // expects the file was opened in "r" mode which is text mode on windows
 // reads f until eol or eof
 // fails on error
@@ -274,6 +279,9 @@ typename Map::mapped_type map_at_or_default(
     return it == map.end() ? default_value : it->second;
 }
 vector<string> split_at_newlines(string text);
+// same as split_at_newlines but returns views into x, only the '\r's at the end of the lines are
+// removed
+vector<array_view<const char>> split_lines(array_view<const char> x);
 
 // call fs::equivalent on existing paths, normalizes and string-compares otherwise
 bool safe_fs_equivalent(string_par x, string_par y);
@@ -539,6 +539,14 @@ void create_directories(const path& p)
 {
     Poco::File(p.string()).createDirectories();
 }
+void copy_file(const path& from, const path& to)
+{
+    Poco::File(from.string()).copyTo(to.string());
+}
+void rename(const path& from, const path& to)
+{
+    Poco::File(from.string()).renameTo(to.string());
+}
 bool exists(const path& p)
 {
     return Poco::File(p.string()).exists();
@@ -136,6 +136,8 @@ void current_path(const path& p);
 void remove(const path& p);
 void remove_all(const path& p);
 void create_directories(const path& p);
+void copy_file(const path& from, const path& to);  // overwrites 'to'
+void rename(const path& from, const path& to);
 path temp_directory_path();
 path canonical(const path& p, const path& base = current_path());
 path absolute(const path& p, const path& base = current_path());
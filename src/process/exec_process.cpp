@@ -1,6 +1,15 @@
 #include "exec_process.h"
 
+#include <algorithm>
+
+#ifdef _WIN32
 #include <thread>
+#else
+#include <cerrno>
+#include <system_error>
+#include <poll.h>
+#include <unistd.h>
+#endif
 
 #include <Poco/Pipe.h>
 #include <Poco/Process.h>
@@ -11,6 +20,7 @@ namespace cmakex {
 using Poco::Process;
 using Poco::Pipe;
 
+#ifdef _WIN32
 void pipereader(Pipe* pipe, exec_process_output_callback_t* callback)
 {
     const int c_bufsize = 4096;
@@ -22,41 +32,143 @@ void pipereader(Pipe* pipe, exec_process_output_callback_t* callback)
         (*callback)(array_view<const char>(&buf[0], r));
     }
 }
+#else
+namespace {
+// the buffer starts small (most processes print a few lines) and it's doubled each time a read
+// fills it
+const int c_min_pipe_bufsize = 4096;
+const int c_max_pipe_bufsize = 256 * 1024;
+
+struct pipe_reader_t
+{
+    pipe_reader_t(Pipe* pipe, exec_process_output_callback_t* callback)
+        : pipe(pipe), callback(callback), buf(c_min_pipe_bufsize)
+    {
+    }
+    Pipe* pipe;
+    exec_process_output_callback_t* callback;
+    vector<char> buf;
+    bool eof = false;
+
+    // reads what's available, false on EOF or error
+    bool read()
+    {
+        for (;;) {
+            auto r = ::read(pipe->readHandle(), buf.data(), buf.size());
+            if (r < 0 && errno == EINTR)
+                continue;
+            if (r <= 0)
+                return false;
+            (*callback)(array_view<const char>(buf.data(), r));
+            if (r == (ssize_t)buf.size() && (int)buf.size() < c_max_pipe_bufsize)
+                buf.resize(std::min<size_t>(2 * buf.size(), c_max_pipe_bufsize));
+            return true;
+        }
+    }
+};
+
+// reads the pipes on the calling thread until each of them is closed by the child, throws if poll
+// fails
+void read_pipes(vector<pipe_reader_t>& readers)
+{
+    vector<pollfd> fds;
+    vector<pipe_reader_t*> fd_readers;
+    for (;;) {
+        fds.clear();
+        fd_readers.clear();
+        for (auto& x : readers) {
+            if (x.eof)
+                continue;
+            pollfd p;
+            p.fd = x.pipe->readHandle();
+            p.events = POLLIN;
+            p.revents = 0;
+            fds.emplace_back(p);
+            fd_readers.emplace_back(&x);
+        }
+        if (fds.empty())
+            return;
+        int r = poll(fds.data(), fds.size(), -1);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            throw std::system_error(errno, std::system_category(),
+                                    "Can't read the output of the child process, poll() failed");
+        }
+        for (size_t i = 0; i < fds.size(); ++i) {
+            // POLLHUP may come with the last bytes, read until EOF
+            if ((fds[i].revents & (POLLIN | POLLHUP | POLLERR | POLLNVAL)) &&
+                !fd_readers[i]->read())
+                fd_readers[i]->eof = true;
+        }
+    }
+}
+}
+#endif
 
 int exec_process(string_par path,
                  const vector<string>& args,
                  string_par working_directory,
                  exec_process_output_callback_t stdout_callback,
-                 exec_process_output_callback_t stderr_callback)
+                 exec_process_output_callback_t stderr_callback,
+                 const exec_process_env_t& env)
 {
     Pipe outpipe, errpipe;
+#ifdef _WIN32
     std::thread outpipe_thread, errpipe_thread;
     if (stdout_callback)
         outpipe_thread = std::thread(&pipereader, &outpipe, &stdout_callback);
     if (stderr_callback)
         errpipe_thread = std::thread(&pipereader, &errpipe, &stderr_callback);
+#endif
     int exit_code = EXIT_FAILURE;
     try {
         auto handle =
-            working_directory.empty()
-                ? Process::launch(path.str(), args, nullptr, stdout_callback ? &outpipe : nullptr,
-                                  stderr_callback ? &errpipe : nullptr)
-                : Process::launch(path.str(), args, working_directory.str(), nullptr,
+            !env.empty()
+                ? Process::launch(path.str(), args, working_directory.str(), nullptr,
                                   stdout_callback ? &outpipe : nullptr,
-                                  stderr_callback ? &errpipe : nullptr);
+                                  stderr_callback ? &errpipe : nullptr, env)
+                : working_directory.empty()
+                      ? Process::launch(path.str(), args, nullptr,
+                                        stdout_callback ? &outpipe : nullptr,
+                                        stderr_callback ? &errpipe : nullptr)
+                      : Process::launch(path.str(), args, working_directory.str(), nullptr,
+                                        stdout_callback ? &outpipe : nullptr,
+                                        stderr_callback ? &errpipe : nullptr);
+#ifndef _WIN32
+        // no reader threads, the pipes of the child are multiplexed on this thread
+        vector<pipe_reader_t> readers;
+        if (stdout_callback)
+            readers.emplace_back(&outpipe, &stdout_callback);
+        if (stderr_callback)
+            readers.emplace_back(&errpipe, &stderr_callback);
+        try {
+            read_pipes(readers);
+        } catch (...) {
+            // the child gets EPIPE or SIGPIPE instead of blocking on the full pipe
+            outpipe.close();
+            errpipe.close();
+            handle.wait();
+            throw;
+        }
+#endif
         exit_code = handle.wait();
     } catch (...) {
+#ifdef _WIN32
         if (outpipe_thread.joinable())
             outpipe_thread.join();
         if (errpipe_thread.joinable())
             errpipe_thread.join();
+#endif
         throw;
     }
 
+#ifdef _WIN32
     if (outpipe_thread.joinable())
         outpipe_thread.join();
     if (errpipe_thread.joinable())
         errpipe_thread.join();
+#endif
 
     return exit_code;
 }
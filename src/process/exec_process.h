@@ -2,6 +2,7 @@
 #define EXEC_PROCESS_0394723
 
 #include <functional>
+#include <map>
 
 #include <adasworks/sx/array_view.h>
 #include <adasworks/sx/mutex.h>
@@ -16,6 +17,8 @@ using std::vector;
 using std::string;
 
 using exec_process_output_callback_t = std::function<void(array_view<const char>)>;
+// variables set in the environment of the child process, in addition to the inherited ones
+using exec_process_env_t = std::map<string, string>;
 
 namespace exec_process_callbacks {
 
@@ -35,7 +38,8 @@ int exec_process(string_par path,
                  const vector<string>& args,
                  string_par working_directory,
                  exec_process_output_callback_t stdout_callback = nullptr,
-                 exec_process_output_callback_t stderr_callback = nullptr);
+                 exec_process_output_callback_t stderr_callback = nullptr,
+                 const exec_process_env_t& env = exec_process_env_t());
 
 inline int exec_process(string_par path,
                         const vector<string>& args,
@@ -1,7 +1,9 @@
 #include "out_err_messages.h"
 
+#include <algorithm>
+#include <cstring>
 #include <deque>
-#include <mutex>
+#include <iterator>
 #include <thread>
 
 #include <Poco/Pipe.h>
@@ -12,36 +14,69 @@
 
 namespace cmakex {
 
-// add_msg is thread-safe
-void OutErrMessagesBuilder::add_msg(source_t source, array_view<const char> msg)
+// the chunks start small (most processes print a few lines) and grow up to a limit
+static const ptrdiff_t k_min_chunk_size = 4096;
+static const ptrdiff_t k_max_chunk_size = 1 << 20;
+
+void OutErrMessagesBuilder::clear()
+{
+    for (auto s : {&stdout_stream, &stderr_stream}) {
+        s->messages.clear();
+        s->last_unfinished_message = nullptr;
+    }
+}
+
+OutErrMessages OutErrMessagesBuilder::move_result()
+{
+    out_err_messages.mark_end_time();
+    // the same order as if the messages had been collected into a single list when they started
+    auto& m = out_err_messages.messages;
+    m.clear();
+    std::merge(stdout_stream.messages.begin(), stdout_stream.messages.end(),
+               stderr_stream.messages.begin(), stderr_stream.messages.end(), std::back_inserter(m),
+               [](const internal::out_err_message_internal_t& x,
+                  const internal::out_err_message_internal_t& y) { return x.t < y.t; });
+    auto tmp = move(out_err_messages);
+    clear();
+    return tmp;
+}
+
+// add_msg is called only by the callback of the stream, the two streams don't share anything so
+// the callbacks may run on different threads without locking
+void OutErrMessagesBuilder::add_msg(stream_t& stream, array_view<const char> msg)
 {
-    internal::out_err_message_internal_t** last_unfinished_message;
-    strings_t* strings;
-    // char source_char = 0;
-    if (source == out_err_message_base_t::source_stdout) {
-        last_unfinished_message = &last_unfinished_stdout_message;
-        strings = &out_err_messages.stdout_strings;
-        // source_char = 'O';
-    } else {
-        last_unfinished_message = &last_unfinished_stderr_message;
-        strings = &out_err_messages.stderr_strings;
-        // source_char = 'E';
+    auto chunks = stream.chunks;
+    auto last_unfinished_message = &stream.last_unfinished_message;
+    auto m = *last_unfinished_message;
+    const ptrdiff_t msg_size = msg.size();
+    if (chunks->empty() || chunks->back().capacity - chunks->back().size < msg_size) {
+        // the unfinished message is the last one in the last chunk, it's moved to the new chunk
+        // to keep it contiguous
+        const ptrdiff_t unfinished_size = m ? m->msg_size : 0;
+        ptrdiff_t capacity =
+            chunks->empty() ? k_min_chunk_size
+                            : std::min(2 * chunks->back().capacity, k_max_chunk_size);
+        capacity = std::max(capacity, 2 * (unfinished_size + msg_size));
+        internal::out_err_chunk_t c;
+        c.data.reset(new char[capacity]);
+        c.capacity = capacity;
+        if (m) {
+            memcpy(c.data.get(), m->msg_begin, unfinished_size);
+            c.size = unfinished_size;
+            m->msg_begin = c.data.get();
+        }
+        chunks->emplace_back(move(c));
     }
-    std::lock_guard<atomic_flag_mutex> lock(mutex);
-    if (*last_unfinished_message) {
-        // auto s0 = (*last_unfinished_message)->msg_end;
-        (*last_unfinished_message)->msg_end += msg.size();
-        // LOG_TRACE("S:%c, msg_end (%d) += %d", source_char, (int)s0, (int)msg.size());
-    } else {
-        ptrdiff_t begin_idx = strings->size();
-        out_err_messages.messages.emplace_back(source, msg_clock::now(), begin_idx,
-                                               begin_idx + msg.size());
-        *last_unfinished_message = &out_err_messages.messages.back();
-        // LOG_TRACE("S:%c, new msg (%d..%d)", source_char, (int)begin_idx, (int)(begin_idx +
-        // msg.size()));
+    auto& chunk = chunks->back();
+    if (!m) {
+        stream.messages.emplace_back(stream.source, msg_clock::now(),
+                                     chunk.data.get() + chunk.size);
+        m = *last_unfinished_message = &stream.messages.back();
     }
-    // LOG_TRACE("S:%c, strings (%d) += %d", source_char, (int)strings->size(), (int)msg.size());
-    strings->insert(strings->end(), msg.begin(), msg.end());
+    if (msg_size > 0)
+        memcpy(chunk.data.get() + chunk.size, msg.data(), msg_size);
+    chunk.size += msg_size;
+    m->msg_size += msg_size;
     const char c_line_feed = 10;
     if (!msg.empty() && msg.end()[-1] == c_line_feed)
         *last_unfinished_message = nullptr;
@@ -50,9 +85,8 @@ void OutErrMessagesBuilder::add_msg(source_t source, array_view<const char> msg)
 out_err_message_t OutErrMessages::at(ptrdiff_t idx) const
 {
     auto& x = messages[idx];
-    auto& strings = x.source == source_t::source_stdout ? stdout_strings : stderr_strings;
-    string s(strings.begin() + x.msg_begin, strings.begin() + x.msg_end);
-    return out_err_message_t(x.source, std::chrono::duration<double>(x.t - start_time).count(), s);
+    return out_err_message_t(x.source, std::chrono::duration<double>(x.t - start_time).count(),
+                             array_view<const char>(x.msg_begin, x.msg_size));
 }
 void OutErrMessages::mark_start_time()
 {
@@ -68,7 +102,7 @@ exec_process_output_callback_t OutErrMessagesBuilder::stdout_callback()
     if (stdout_mode == pipe_echo)
         return {};
     return [this](array_view<const char> x) {
-        add_msg(out_err_message_base_t::source_stdout, x);
+        add_msg(stdout_stream, x);
         if (stdout_mode == pipe_echo_and_capture)
             exec_process_callbacks::print_to_stdout(x);
     };
@@ -78,7 +112,7 @@ exec_process_output_callback_t OutErrMessagesBuilder::stderr_callback()
     if (stderr_mode == pipe_echo)
         return {};
     return [this](array_view<const char> x) {
-        add_msg(out_err_message_base_t::source_stderr, x);
+        add_msg(stderr_stream, x);
         if (stderr_mode == pipe_echo_and_capture)
             exec_process_callbacks::print_to_stderr(x);
     };
@@ -6,6 +6,8 @@
 #include <cmath>
 #include <deque>
 #include <functional>
+#include <memory>
+#include <vector>
 
 #include <adasworks/sx/mutex.h>
 
@@ -35,32 +37,37 @@ struct out_err_message_internal_t : public out_err_message_base_t
     using msg_clock = std::chrono::high_resolution_clock;
     using time_point = msg_clock::time_point;
 
-    out_err_message_internal_t(source_t source,
-                               time_point t,
-                               ptrdiff_t msg_begin,
-                               ptrdiff_t msg_end)
-        : out_err_message_base_t(source), t(t), msg_begin(msg_begin), msg_end(msg_end)
+    out_err_message_internal_t(source_t source, time_point t, const char* msg_begin)
+        : out_err_message_base_t(source), t(t), msg_begin(msg_begin)
     {
     }
 
     time_point t;
-    ptrdiff_t msg_begin, msg_end;
+    const char* msg_begin;  // points into a chunk of OutErrMessages
+    ptrdiff_t msg_size = 0;
+};
+
+// the text of the messages of one source in large, never reallocated chunks, a message is always
+// contiguous
+struct out_err_chunk_t
+{
+    std::unique_ptr<char[]> data;
+    ptrdiff_t size = 0, capacity = 0;
 };
 }
 
+// a message of OutErrMessages, valid while the OutErrMessages object lives
 struct out_err_message_t : public out_err_message_base_t
 {
-    out_err_message_t(source_t source, double t, const std::string& text)
+    out_err_message_t(source_t source, double t, array_view<const char> text)
         : out_err_message_base_t(source), t(t), text(text)
     {
     }
-    out_err_message_t(source_t source, double t, std::string&& text)
-        : out_err_message_base_t(source), t(t), text(move(text))
-    {
-    }
 
-    double t = NAN;  // time since process launch time
-    string text;     // message text, as received from the pipe
+    string str() const { return string(text.begin(), text.end()); }
+
+    double t = NAN;               // time since process launch time
+    array_view<const char> text;  // message text, as received from the pipe
 };
 
 class OutErrMessagesBuilder;
@@ -69,7 +76,7 @@ class OutErrMessagesBuilder;
 class OutErrMessages
 {
 private:
-    using strings_t = std::deque<char>;
+    using chunks_t = std::vector<internal::out_err_chunk_t>;
     using system_clock = std::chrono::system_clock;
 
 public:
@@ -80,8 +87,8 @@ public:
     OutErrMessages(const OutErrMessages&) = delete;
     OutErrMessages(OutErrMessages&& x)
         : messages(move(x.messages)),
-          stdout_strings(move(x.stdout_strings)),
-          stderr_strings(move(x.stderr_strings)),
+          stdout_chunks(move(x.stdout_chunks)),
+          stderr_chunks(move(x.stderr_chunks)),
           start_time(move(x.start_time)),
           start_system_time_(move(x.start_system_time_)),
           end_system_time_(move(x.end_system_time_))
@@ -94,14 +101,14 @@ public:
     system_clock::time_point end_system_time() const { return end_system_time_; }
     bool empty() const { return messages.empty(); }
     ptrdiff_t size() const { return messages.size(); }
-    out_err_message_t at(ptrdiff_t idx) const;
+    out_err_message_t at(ptrdiff_t idx) const;  // no copy, refers to the stored text
 
 private:
     friend class OutErrMessagesBuilder;
     using messages_t = std::deque<internal::out_err_message_internal_t>;
     messages_t messages;
-    strings_t stdout_strings;
-    strings_t stderr_strings;
+    chunks_t stdout_chunks;
+    chunks_t stderr_chunks;
     msg_clock::time_point start_time;
     system_clock::time_point start_system_time_;
     system_clock::time_point end_system_time_;
@@ -124,27 +131,35 @@ public:
     }
     exec_process_output_callback_t stdout_callback();
     exec_process_output_callback_t stderr_callback();
-    OutErrMessages move_result()
-    {
-        out_err_messages.mark_end_time();
-        auto tmp = move(out_err_messages);
-        clear();
-        return tmp;
-    }
+    // merges the messages of the two streams by time, call it after the process has finished
+    OutErrMessages move_result();
 
 private:
     using source_t = OutErrMessages::source_t;
     using msg_clock = OutErrMessages::msg_clock;
-    using strings_t = OutErrMessages::strings_t;
+    using chunks_t = OutErrMessages::chunks_t;
+    using messages_t = OutErrMessages::messages_t;
+
+    // everything a stream's callback touches, no locking is needed as long as each stream has a
+    // single producer
+    struct stream_t
+    {
+        stream_t(source_t source, chunks_t* chunks) : source(source), chunks(chunks) {}
+        source_t source;
+        chunks_t* chunks;  // points into out_err_messages
+        messages_t messages;
+        internal::out_err_message_internal_t* last_unfinished_message = nullptr;
+    };
 
-    void clear() { last_unfinished_stdout_message = last_unfinished_stderr_message = nullptr; }
-    void add_msg(source_t source, array_view<const char> msg);
+    void clear();
+    void add_msg(stream_t& stream, array_view<const char> msg);
 
     const pipe_mode_t stdout_mode, stderr_mode;
     OutErrMessages out_err_messages;
-    atomic_flag_mutex mutex;
-    internal::out_err_message_internal_t* last_unfinished_stdout_message = nullptr;
-    internal::out_err_message_internal_t* last_unfinished_stderr_message = nullptr;
+    stream_t stdout_stream{out_err_message_base_t::source_stdout,
+                           &out_err_messages.stdout_chunks};
+    stream_t stderr_stream{out_err_message_base_t::source_stderr,
+                           &out_err_messages.stderr_chunks};
 };
 }
 #endif
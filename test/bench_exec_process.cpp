@@ -0,0 +1,83 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <adasworks/sx/check.h>
+#include <adasworks/sx/log.h>
+
+#include "exec_process.h"
+#include "filesystem.h"
+
+using std::string;
+namespace fs = filesystem;
+using std::vector;
+
+// prints `bytes` bytes to stdout and a line to stderr
+int child(long long bytes)
+{
+    string line(79, 'x');
+    line += '\n';
+    for (long long n = 0; n < bytes; n += line.size())
+        fwrite(line.data(), 1, std::min<long long>(line.size(), bytes - n), stdout);
+    fprintf(stderr, "done\n");
+    return EXIT_SUCCESS;
+}
+
+// Measures exec_process: the time of launching a child which prints a few lines and the
+// throughput of reading a child's large output through the callbacks. The child is this
+// executable.
+// $1 = number of children launched (default: 1000)
+// $2 = size of the large output in megabytes (default: 400)
+int main(int argc, char* argv[])
+{
+    if (argc == 3 && string(argv[1]) == "--child")
+        return child(atoll(argv[2]));
+    try {
+        adasworks::log::Logger global_logger(adasworks::log::global_tag);
+
+        CHECK(argc <= 3);
+        int runs = argc > 1 ? atoi(argv[1]) : 1000;
+        long long megabytes = argc > 2 ? atoll(argv[2]) : 400;
+        CHECK(runs > 0 && megabytes > 0);
+
+        string self = fs::absolute(argv[0]).string();
+        // the callbacks may be called on different threads
+        std::atomic<long long> bytes_read(0);
+        auto count_bytes = [&bytes_read](cmakex::array_view<const char> x) {
+            bytes_read += x.size();
+        };
+        using clock = std::chrono::steady_clock;
+        auto seconds_since = [](clock::time_point t0) {
+            return std::chrono::duration<double>(clock::now() - t0).count();
+        };
+
+        auto t0 = clock::now();
+        for (int i = 0; i < runs; ++i) {
+            int r = cmakex::exec_process(self, {"--child", "200"}, count_bytes, count_bytes);
+            CHECK(r == EXIT_SUCCESS);
+        }
+        double t = seconds_since(t0);
+        CHECK(bytes_read == runs * 205LL, "%lld bytes read", bytes_read.load());
+        printf("%d children with short output: %.3f s, %.3f ms per child\n", runs, t,
+               1000 * t / runs);
+
+        bytes_read = 0;
+        long long bytes = megabytes * 1024 * 1024;
+        t0 = clock::now();
+        int r = cmakex::exec_process(self, {"--child", std::to_string(bytes)}, count_bytes,
+                                     count_bytes);
+        t = seconds_since(t0);
+        CHECK(r == EXIT_SUCCESS);
+        CHECK(bytes_read == bytes + 5);
+        printf("%lld MB of output: %.3f s, %.1f MB/s\n", megabytes, t, megabytes / t);
+        return EXIT_SUCCESS;
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Exception: %s\n", e.what());
+    } catch (...) {
+        fprintf(stderr, "Unknown exception\n");
+    }
+    return EXIT_FAILURE;
+}
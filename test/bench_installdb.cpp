@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include <adasworks/sx/check.h>
+#include <adasworks/sx/log.h>
+
+#include "installdb.h"
+#include "misc_utils.h"
+
+using std::string;
+using std::vector;
+using adasworks::sx::stringf;
+
+// Measures the SHAs of the installed configs on a synthetic dependency graph: calculating them
+// once, when the descs are put into installed_pkg_configs_t (as InstallDB does when it reads or
+// writes them) and comparing them with the deps_shas of the dependents, against calculating the
+// SHA of the dependency for each edge and config (as it was done before they were stored).
+// $1 = number of packages (default: 500)
+// $2 = max number of direct dependencies of a package (default: 8)
+int main(int argc, char* argv[])
+{
+    try {
+        adasworks::log::Logger global_logger(adasworks::log::global_tag);
+
+        CHECK(argc <= 3);
+        int n_pkgs = argc > 1 ? atoi(argv[1]) : 500;
+        int max_deps = argc > 2 ? atoi(argv[2]) : 8;
+        CHECK(n_pkgs > 0 && max_deps >= 0);
+        const vector<cmakex::config_name_t> configs = {cmakex::config_name_t("Debug"),
+                                                       cmakex::config_name_t("Release")};
+
+        // each package depends on some of the packages before it, the edges are pseudo-random
+        // but the same in each run
+        unsigned rnd = 12345;
+        auto next_rnd = [&rnd]() {
+            rnd = rnd * 1103515245u + 12345u;
+            return (rnd >> 16) & 0x7fff;
+        };
+        auto pkg_name = [](int i) { return stringf("pkg%03d", i); };
+        vector<vector<int>> deps(n_pkgs);
+        int n_edges = 0;
+        for (int i = 1; i < n_pkgs; ++i) {
+            int n = std::min<int>(i, next_rnd() % (max_deps + 1));
+            for (int j = 0; j < n; ++j)
+                deps[i].emplace_back(next_rnd() % i);
+            deps[i] = cmakex::stable_unique(deps[i]);
+            n_edges += deps[i].size();
+        }
+
+        // the descs, as they would be written after building the packages in order
+        vector<cmakex::installed_pkg_configs_t> installed(n_pkgs);
+        vector<vector<cmakex::installed_config_desc_t>> descs(n_pkgs);
+        for (int i = 0; i < n_pkgs; ++i) {
+            for (auto& config : configs) {
+                cmakex::installed_config_desc_t d(pkg_name(i), config);
+                d.git_url = stringf("https://example.com/%s.git", pkg_name(i).c_str());
+                d.git_sha = cmakex::string_sha(d.git_url);
+                d.source_dir = "src";
+                for (auto a : {"-DBUILD_SHARED_LIBS=OFF", "-DBUILD_TESTING=OFF",
+                               "-DCMAKE_POSITION_INDEPENDENT_CODE=ON", "-DWITH_EXAMPLES=OFF",
+                               "-GNinja"})
+                    d.final_cmake_args.args.emplace_back(a);
+                d.final_cmake_args.args.emplace_back("-DCMAKE_BUILD_TYPE=" +
+                                                     config.get_prefer_NoConfig());
+                d.final_cmake_args.args.emplace_back("-DCMAKE_INSTALL_PREFIX=/tmp/_deps-install");
+                for (int dep : deps[i])
+                    d.deps_shas[pkg_name(dep)][config] = installed[dep].config_sha(config);
+                descs[i].emplace_back(d);
+                installed[i].put(d);
+            }
+        }
+
+        using clock = std::chrono::steady_clock;
+        auto ms_since = [](clock::time_point t0) {
+            return std::chrono::duration<double, std::milli>(clock::now() - t0).count();
+        };
+
+        // put: the SHA is calculated once per config
+        auto t0 = clock::now();
+        vector<cmakex::installed_pkg_configs_t> loaded(n_pkgs);
+        for (int i = 0; i < n_pkgs; ++i) {
+            for (auto& d : descs[i])
+                loaded[i].put(d);
+        }
+        double t_put = ms_since(t0);
+
+        // checking each edge and config with the stored SHAs
+        int changed = 0;
+        t0 = clock::now();
+        for (int i = 0; i < n_pkgs; ++i) {
+            for (auto& d : descs[i]) {
+                for (auto& kv : d.deps_shas) {
+                    auto& dep = loaded[atoi(kv.first.c_str() + 3)];
+                    for (auto& kv2 : kv.second)
+                        changed += dep.config_sha(kv2.first) != kv2.second;
+                }
+            }
+        }
+        double t_stored = ms_since(t0);
+        CHECK(changed == 0);
+
+        // checking each edge and config by calculating the SHA of the dependency's desc
+        t0 = clock::now();
+        for (int i = 0; i < n_pkgs; ++i) {
+            for (auto& d : descs[i]) {
+                for (auto& kv : d.deps_shas) {
+                    auto& dep = loaded[atoi(kv.first.c_str() + 3)];
+                    for (auto& kv2 : kv.second) {
+                        auto& dep_desc = dep.config_descs.at(kv2.first);
+                        changed += cmakex::calc_sha(dep_desc) != kv2.second;
+                    }
+                }
+            }
+        }
+        double t_recalc = ms_since(t0);
+        CHECK(changed == 0);
+
+        printf("%d packages, %d configs, %d edges\n", n_pkgs, (int)configs.size(), n_edges);
+        printf("put (SHA once per config):           %8.2f ms\n", t_put);
+        printf("edge checks with the stored SHAs:    %8.2f ms\n", t_stored);
+        printf("edge checks calculating the SHAs:    %8.2f ms\n", t_recalc);
+        return EXIT_SUCCESS;
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Exception: %s\n", e.what());
+    } catch (...) {
+        fprintf(stderr, "Unknown exception\n");
+    }
+    return EXIT_FAILURE;
+}
@@ -117,11 +117,11 @@ int main(int argc, char* argv[])
                 swap(m1, m2);
             }
             CHECK(m1.source == cmakex::out_err_message_t::source_stdout);
-            CHECK(m1.text.substr(0, expected_out.size()) == expected_out);
+            CHECK(m1.str().substr(0, expected_out.size()) == expected_out);
             CHECK(m2.source == cmakex::out_err_message_t::source_stderr);
-            LOG_INFO("checking '%s' == '%s'", m2.text.substr(0, expected_err.size()).c_str(),
+            LOG_INFO("checking '%s' == '%s'", m2.str().substr(0, expected_err.size()).c_str(),
                      expected_err.c_str());
-            CHECK(m2.text.substr(0, expected_err.size()) == expected_err);
+            CHECK(m2.str().substr(0, expected_err.size()) == expected_err);
         }
 
         return EXIT_SUCCESS;
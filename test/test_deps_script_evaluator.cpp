@@ -0,0 +1,195 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <set>
+#include <string>
+
+#include <Poco/Environment.h>
+#include <Poco/Glob.h>
+
+#include <adasworks/sx/check.h>
+#include <adasworks/sx/log.h>
+
+#include "deps_script_evaluator.h"
+#include "exec_process.h"
+#include "filesystem.h"
+#include "misc_utils.h"
+#include "out_err_messages.h"
+#include "print.h"
+#include "resource.h"
+
+using std::string;
+namespace fs = filesystem;
+using std::vector;
+using adasworks::sx::stringf;
+
+static const char* const cmakex_version_mmp = STRINGIZE(CMAKEX_VERSION_MMP);
+
+// same as the wrapper project written by HelperCmakeProject
+string wrapper_cmakelists()
+{
+    return string(
+               "cmake_minimum_required(VERSION ${CMAKE_VERSION})\n\n"
+               "if(DEFINED __CMAKEX_EXECUTOR_PROJECT_COMMAND)\n"
+               "    set(command \"${__CMAKEX_EXECUTOR_PROJECT_COMMAND}\")\n"
+               "    unset(__CMAKEX_EXECUTOR_PROJECT_COMMAND CACHE)\n"
+               "endif()\n\n") +
+           cmakex::k_deps_script_wrapper_cmakelists_body;
+}
+
+int run_cmake(const vector<string>& args)
+{
+    string e = "$ cmake";
+    for (auto& a : args)
+        e += string(" ") + a;
+    LOG_INFO("%s", e.c_str());
+    cmakex::OutErrMessagesBuilder oeb(cmakex::pipe_capture, cmakex::pipe_capture);
+    int r = cmakex::exec_process("cmake", args, oeb.stdout_callback(), oeb.stderr_callback());
+    if (r) {
+        auto oem = oeb.move_result();
+        for (int i = 0; i < oem.size(); ++i)
+            fprintf(stderr, "%s", oem.at(i).str().c_str());
+    }
+    return r;
+}
+
+std::map<string, string> read_cmake_cache_vars(const string& path)
+{
+    std::map<string, string> vars;
+    for (auto& line : cmakex::must_read_file_as_lines(path)) {
+        if (line.empty() || line[0] == '#' || cmakex::starts_with(line, "//"))
+            continue;
+        auto name_end = line.find_first_of(":=");
+        auto equal_pos = line.find('=');
+        if (name_end == string::npos || equal_pos == string::npos)
+            continue;
+        vars[line.substr(0, name_end)] = line.substr(equal_pos + 1);
+    }
+    return vars;
+}
+
+// Compares the in-process evaluation of the deps scripts with the wrapper project run by cmake.
+// The native_*.cmake scripts must be evaluated in-process with the same result, the
+// fallback_*.cmake ones must be left to cmake. Also checks which scripts may affect the scripts
+// evaluated after them in the same cmake process.
+// $1 = path to the dir of the test scripts
+// $2 = path to the binary dir (to be created)
+int main(int argc, char* argv[])
+{
+    try {
+        adasworks::log::Logger global_logger(adasworks::log::global_tag, AW_TRACE);
+
+        CHECK(argc == 3);
+
+        string scripts_dir = fs::absolute(argv[1]).string();
+        string build_dir = fs::absolute(argv[2]).string();
+        string wrapper_dir = build_dir + "/wrapper";
+        string wrapper_binary_dir = build_dir + "/b";
+        string add_pkg_out_file = build_dir + "/add_pkg_out.txt";
+        string included_files_out_file = build_dir + "/included_files_out.txt";
+
+        LOG_INFO("scripts_dir: %s", scripts_dir.c_str());
+        LOG_INFO("build_dir: %s", build_dir.c_str());
+
+        try {
+            fs::remove_all(build_dir);
+        } catch (...) {
+        }
+        fs::create_directories(wrapper_dir);
+        cmakex::must_write_text(wrapper_dir + "/CMakeLists.txt", wrapper_cmakelists());
+
+        // the scripts refer to these
+        Poco::Environment::set("CMAKEX_TEST_ENV", "from_env");
+        int r = run_cmake({"-H" + wrapper_dir, "-B" + wrapper_binary_dir,
+                           string("-DCMAKEX_VERSION=") + cmakex_version_mmp, "-DNUM=5",
+                           "-DWITH_FOO=ON"});
+        CHECK(r == 0);
+        auto cache_vars = read_cmake_cache_vars(wrapper_binary_dir + "/CMakeCache.txt");
+
+        // the ones deps_script_may_affect_later_scripts must find
+        const std::set<string> affecting_later_scripts = {
+            "fallback_cache.cmake", "fallback_find_package.cmake", "fallback_function.cmake",
+            "fallback_include_optional.cmake", "fallback_parent_scope.cmake",
+            "fallback_parse_error.cmake", "fallback_set_env.cmake", "fallback_unset_env.cmake"};
+        // the ones deps_script_may_depend_on_environment must find
+        const std::set<string> depending_on_environment = {
+            "fallback_find_package.cmake", "fallback_include_optional.cmake",
+            "fallback_parse_error.cmake", "native_conditions.cmake", "native_syntax.cmake"};
+
+        std::set<string> scripts;
+        Poco::Glob::glob(scripts_dir + "/*.cmake", scripts);
+        CHECK(!scripts.empty());
+        int failures = 0;
+        for (auto& script : scripts) {
+            auto name = fs::path(script).filename().string();
+            bool expect_native = cmakex::starts_with(name, "native_");
+            CHECK(expect_native || cmakex::starts_with(name, "fallback_"));
+
+            bool expect_affects = affecting_later_scripts.count(name) > 0;
+            if (cmakex::deps_script_may_affect_later_scripts(script) != expect_affects) {
+                LOG_ERROR("%s: expected to %s the scripts after it", name.c_str(),
+                          expect_affects ? "affect" : "not affect");
+                ++failures;
+            }
+            bool expect_depends = depending_on_environment.count(name) > 0;
+            if (cmakex::deps_script_may_depend_on_environment(script) != expect_depends) {
+                LOG_ERROR("%s: expected to %s on the environment", name.c_str(),
+                          expect_depends ? "depend" : "not depend");
+                ++failures;
+            }
+
+            auto native = cmakex::evaluate_deps_script_natively(script, cache_vars);
+            if (!expect_native) {
+                if (native) {
+                    LOG_ERROR("%s: evaluated in-process, expected to fall back to cmake",
+                              name.c_str());
+                    ++failures;
+                } else
+                    LOG_INFO("%s: falls back to cmake", name.c_str());
+                continue;
+            }
+            if (!native) {
+                LOG_ERROR("%s: falls back to cmake, expected to be evaluated in-process",
+                          name.c_str());
+                ++failures;
+                continue;
+            }
+
+            for (auto& p : {add_pkg_out_file, included_files_out_file})
+                cmakex::must_write_text(p, "");
+            r = run_cmake({wrapper_binary_dir,
+                           "-D__CMAKEX_EXECUTOR_PROJECT_COMMAND=run;" + script + ";" +
+                               add_pkg_out_file + ";" + included_files_out_file});
+            CHECK(r == 0);
+            auto expected = cmakex::must_read_file_as_lines(add_pkg_out_file);
+            if (*native != expected) {
+                LOG_ERROR("%s: different result", name.c_str());
+                for (auto& l : *native)
+                    LOG_ERROR("    native: %s", l.c_str());
+                for (auto& l : expected)
+                    LOG_ERROR("    cmake:  %s", l.c_str());
+                ++failures;
+            } else
+                LOG_INFO("%s: same result (%d lines)", name.c_str(), (int)expected.size());
+        }
+
+        // the host's UNIX, WIN32, etc.. are not valid for a cross build
+        for (auto v : {"CMAKE_SYSTEM_NAME", "CMAKE_CROSSCOMPILING"}) {
+            auto vars = cache_vars;
+            vars[v] = cmakex::starts_with(v, "CMAKE_SYSTEM") ? "Android" : "ON";
+            if (cmakex::evaluate_deps_script_natively(scripts_dir + "/native_conditions.cmake",
+                                                      vars)) {
+                LOG_ERROR("native_conditions.cmake: evaluated in-process with %s set", v);
+                ++failures;
+            }
+        }
+
+        CHECK(failures == 0, "%d failures", failures);
+        return EXIT_SUCCESS;
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Exception: %s\n", e.what());
+    } catch (...) {
+        fprintf(stderr, "Unknown exception\n");
+    }
+    return EXIT_FAILURE;
+}
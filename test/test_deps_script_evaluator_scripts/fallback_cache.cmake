@@ -0,0 +1,5 @@
+# cache variables are seen by the scripts included later
+set(WITH_BAZ ON CACHE BOOL "")
+if(WITH_BAZ)
+  add_pkg(baz)
+endif()
@@ -0,0 +1,4 @@
+# variable defined by cmake
+if(${CMAKE_SYSTEM_NAME} STREQUAL Linux)
+add_pkg(a)
+endif()
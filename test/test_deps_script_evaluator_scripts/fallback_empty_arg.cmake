@@ -0,0 +1,5 @@
+# the wrapper drops the empty arguments of add_pkg
+if(FALSE)
+  message(FATAL_ERROR "never")
+endif()
+add_pkg(x "")
@@ -0,0 +1,3 @@
+# unsupported command
+find_package(Foo)
+add_pkg(a)
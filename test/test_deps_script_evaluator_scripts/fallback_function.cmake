@@ -0,0 +1,5 @@
+# functions and macros are seen by the scripts included later
+function(add_my_pkg name)
+  add_pkg(${name})
+endfunction()
+add_my_pkg(a)
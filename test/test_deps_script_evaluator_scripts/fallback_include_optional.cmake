@@ -0,0 +1,2 @@
+# include(... OPTIONAL)
+include(${CMAKE_CURRENT_LIST_DIR}/nonexistent.cmake OPTIONAL)
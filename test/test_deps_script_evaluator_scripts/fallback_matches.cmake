@@ -0,0 +1,4 @@
+# regular expressions are not supported
+if(x MATCHES "^a")
+add_pkg(m)
+endif()
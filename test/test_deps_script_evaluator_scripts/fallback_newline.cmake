@@ -0,0 +1,4 @@
+# list and multi-line arguments
+set(x "a;b")
+add_pkg(x ${x} "multi
+line")
@@ -0,0 +1,4 @@
+# cmake fails on NOT NOT
+if(NOT NOT 1)
+add_pkg(a)
+endif()
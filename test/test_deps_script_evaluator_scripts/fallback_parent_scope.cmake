@@ -0,0 +1,2 @@
+# set(PARENT_SCOPE)
+set(x 1 PARENT_SCOPE)
@@ -0,0 +1,2 @@
+# two commands in a line, cmake fails, too
+add_pkg(x) add_pkg(y)
@@ -0,0 +1,2 @@
+# set(ENV{...})
+set(ENV{CMAKEX_TEST_SET_ENV} 1)
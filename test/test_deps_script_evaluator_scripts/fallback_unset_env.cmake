@@ -0,0 +1,2 @@
+# unset(ENV{...})
+unset(ENV{CMAKEX_TEST_ENV})
@@ -0,0 +1,8 @@
+# numeric, string and version comparisons
+add_pkg(p CMAKE_ARGS "-DX=${NUM}" -DY=${WITH_FOO} "\${NOT_EXPANDED}")
+if(NUM EQUAL 5.0 AND "10" GREATER_EQUAL NUM AND 1.2.3 VERSION_LESS 1.10)
+  add_pkg(numeq)
+endif()
+if(a STRLESS b)
+  add_pkg(strless)
+endif()
@@ -0,0 +1,3 @@
+# add_pkg and def_pkg with quoted and unquoted arguments
+add_pkg(zlib GIT_URL https://github.com/madler/zlib GIT_TAG v1.2.11)
+def_pkg(png GIT_URL "https://x/png" CMAKE_ARGS -DPNG_SHARED=OFF "-DA=b c")
@@ -0,0 +1,30 @@
+# variables from the cache (NUM=5, WITH_FOO=ON) and the usual if() operators
+set(tag v1.0)
+set(args -DA=1 -DB=2)
+if(WITH_FOO)
+  add_pkg(foo GIT_TAG ${tag} CMAKE_ARGS ${args})
+elseif(WITH_BAR)
+  add_pkg(bar)
+else()
+  add_pkg(baz)
+endif()
+if(NOT WITH_BAR AND (NUM GREATER 3 OR NUM LESS 1))
+  add_pkg(num_big SOURCE_DIR ${CMAKE_CURRENT_LIST_DIR}/x)
+endif()
+if(UNDEF_X STREQUAL "UNDEF_X")
+  add_pkg(literal_cmp)
+endif()
+if("${tag}" VERSION_GREATER 0.9.1 AND tag STREQUAL v1.0)
+  add_pkg(ver)
+endif()
+if(DEFINED tag AND NOT DEFINED nope AND DEFINED ENV{CMAKEX_TEST_ENV})
+  add_pkg(defd)
+endif()
+message(STATUS "hello")
+unset(tag)
+if(DEFINED tag)
+  add_pkg(bad)
+endif()
+if(UNIX AND NOT WIN32)
+  add_pkg(unix_only)
+endif()
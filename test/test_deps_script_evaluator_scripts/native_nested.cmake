@@ -0,0 +1,28 @@
+# nested if blocks, nested variable references, precedence
+set(n tag)
+set(tag v2)
+set(v "line \
+cont")
+if(NOT UNSET_VAR)
+  if(0)
+    add_pkg(no)
+  elseif(NOT 1)
+    add_pkg(no2)
+  elseif(${n} STREQUAL v2)
+    if(1)
+      add_pkg(nested ${${n}} "${v}")
+    endif()
+  else()
+    add_pkg(no3)
+  endif()
+endif()
+if((1 AND (0 OR 1)) AND NOT (0))
+  add_pkg(parens)
+endif()
+if(NOT 0 OR 0 AND 0)
+  add_pkg(prec)
+endif()
+if(1 VERSION_EQUAL 1.0.0 AND 1.2a VERSION_GREATER 1.1)
+add_pkg(verx)
+endif ( )
+add_pkg(x "a\tb" \$x \# [=[]]]=])
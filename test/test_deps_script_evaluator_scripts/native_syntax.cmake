@@ -0,0 +1,20 @@
+# bracket arguments and comments, escapes, case-insensitive commands, constants
+#[[ bracket
+comment ]]
+add_pkg(a #[=[ inline ]=] GIT_TAG [[raw${x}]] X "q\"uo\\te\$" $ENV{CMAKEX_TEST_ENV})
+If(1)
+ADD_PKG(b)
+Endif()
+set(l a b c)
+if(b IN_LIST l)
+  add_pkg(inlist)
+endif()
+if(EXISTS ${CMAKE_CURRENT_LIST_DIR}/native_basic.cmake AND IS_DIRECTORY ${CMAKE_CURRENT_LIST_DIR} AND IS_ABSOLUTE /x)
+  add_pkg(fs)
+endif()
+if(0 OR "" OR OFF OR x-NOTFOUND OR "abc")
+  add_pkg(bad)
+endif()
+if(2.5 AND "yes")
+  add_pkg(numtrue)
+endif()
@@ -0,0 +1,163 @@
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+
+#include <nowide/fstream.hpp>
+
+#include <adasworks/sx/check.h>
+#include <adasworks/sx/log.h>
+
+#include "filesystem.h"
+#include "installdb.h"
+#include "misc_utils.h"
+
+using std::string;
+namespace fs = filesystem;
+using std::vector;
+
+string read_binary_file(const string& path)
+{
+    nowide::ifstream f(path.c_str(), std::ios_base::in | std::ios_base::binary);
+    CHECK(f.good(), "Can't open %s", path.c_str());
+    return string(std::istreambuf_iterator<char>(f), std::istreambuf_iterator<char>());
+}
+
+void write_binary_file(const string& path, const string& data)
+{
+    nowide::ofstream f(path.c_str(), std::ios_base::out | std::ios_base::binary);
+    f.write(data.data(), data.size());
+    CHECK(f.good(), "Can't write %s", path.c_str());
+}
+
+cmakex::installed_config_desc_t make_desc(const string& pkg_name,
+                                          const string& config,
+                                          const string& git_sha)
+{
+    cmakex::installed_config_desc_t d(pkg_name, cmakex::config_name_t(config));
+    d.git_sha = git_sha;
+    return d;
+}
+
+// "pkg config:sha config:sha ..." of the installed configs of the packages
+string installed_configs(const cmakex::InstallDB& db,
+                         const vector<string>& pkg_names,
+                         const string& prefix_path)
+{
+    string r;
+    for (auto& pkg_name : pkg_names) {
+        r += r.empty() ? pkg_name : " | " + pkg_name;
+        auto ipc = db.try_get_installed_pkg_all_configs(pkg_name, prefix_path);
+        for (auto& kv : ipc.config_descs)
+            r += " " + kv.first.get_prefer_NoConfig() + ":" + kv.second.git_sha;
+    }
+    return r;
+}
+
+// Writes a binary installdb then reads copies of it (as prefix paths, each of them is loaded
+// from the files once) after damaging the end of the journal.
+// $1 = path to the binary dir (to be created)
+int main(int argc, char* argv[])
+{
+    try {
+        adasworks::log::Logger global_logger(adasworks::log::global_tag, AW_TRACE);
+
+        CHECK(argc == 2);
+
+        string build_dir = fs::absolute(argv[1]).string();
+        LOG_INFO("build_dir: %s", build_dir.c_str());
+
+        try {
+            fs::remove_all(build_dir);
+        } catch (...) {
+        }
+        fs::create_directories(build_dir);
+
+        const vector<string> pkgs = {"a", "b", "c"};
+        int failures = 0;
+        auto check_configs = [&failures](const string& what, const string& actual,
+                                         const string& expected) {
+            if (actual == expected)
+                LOG_INFO("%s: %s", what.c_str(), actual.c_str());
+            else {
+                LOG_ERROR("%s: %s, expected: %s", what.c_str(), actual.c_str(),
+                          expected.c_str());
+                ++failures;
+            }
+        };
+
+        // the snapshot and journal written through the local installdb of a binary dir
+        string writer_binary_dir = build_dir + "/w";
+        string writer_db = writer_binary_dir + "/_deps-install/_cmakex/installdb";
+        cmakex::InstallDB db(writer_binary_dir);
+        db.install_with_unspecified_files(make_desc("a", "Debug", "1"));
+        db.convert(true);
+        CHECK(fs::is_regular_file(writer_db + ".bin") && !fs::exists(writer_db));
+        db.install_with_unspecified_files(make_desc("a", "Release", "2"));
+        db.install_with_unspecified_files(make_desc("b", "Release", "3"));
+        db.install_with_unspecified_files(make_desc("b", "Release", "4"));
+        db.uninstall_config_if_installed("a", cmakex::config_name_t("Debug"));
+        CHECK(fs::is_regular_file(writer_db + ".journal"));
+        const string expected_all = "a Release:2 | b Release:4 | c";
+        check_configs("written", installed_configs(db, pkgs, ""), expected_all);
+
+        const string snapshot = read_binary_file(writer_db + ".bin");
+        const string journal = read_binary_file(writer_db + ".journal");
+
+        // puts the snapshot and the journal into a new prefix path
+        int n_prefixes = 0;
+        auto make_prefix = [&](const string& journal_data) {
+            string prefix = build_dir + "/p" + std::to_string(++n_prefixes);
+            fs::create_directories(prefix + "/_cmakex");
+            write_binary_file(prefix + "/_cmakex/installdb.bin", snapshot);
+            write_binary_file(prefix + "/_cmakex/installdb.journal", journal_data);
+            return prefix;
+        };
+
+        check_configs("replayed", installed_configs(db, pkgs, make_prefix(journal)),
+                      expected_all);
+
+        // the last record (removing a/Debug) is incomplete
+        auto torn_journal = journal.substr(0, journal.size() - 5);
+        check_configs("torn record", installed_configs(db, pkgs, make_prefix(torn_journal)),
+                      "a Debug:1 Release:2 | b Release:4 | c");
+
+        // the checksum of the last record doesn't match
+        auto corrupt_journal = journal;
+        corrupt_journal.back() ^= 1;
+        check_configs("corrupt record", installed_configs(db, pkgs, make_prefix(corrupt_journal)),
+                      "a Debug:1 Release:2 | b Release:4 | c");
+
+        // the journal file has just been created
+        check_configs("incomplete header",
+                      installed_configs(db, pkgs, make_prefix(journal.substr(0, 3))),
+                      "a Debug:1 | b | c");
+
+        // the next change after a torn journal writes a new snapshot and removes the journal
+        {
+            string binary_dir = build_dir + "/t";
+            string dbdir = binary_dir + "/_deps-install/_cmakex";
+            fs::create_directories(dbdir);
+            write_binary_file(dbdir + "/installdb.bin", snapshot);
+            write_binary_file(dbdir + "/installdb.journal", corrupt_journal);
+            cmakex::InstallDB db2(binary_dir);
+            db2.install_with_unspecified_files(make_desc("c", "Debug", "5"));
+            CHECK(!fs::exists(dbdir + "/installdb.journal"));
+            CHECK(!fs::exists(dbdir + "/installdb"));
+            auto compacted = read_binary_file(dbdir + "/installdb.bin");
+            string prefix = build_dir + "/compacted";
+            fs::create_directories(prefix + "/_cmakex");
+            write_binary_file(prefix + "/_cmakex/installdb.bin", compacted);
+            check_configs("compacted", installed_configs(db, pkgs, prefix),
+                          "a Debug:1 Release:2 | b Release:4 | c Debug:5");
+        }
+
+        CHECK(failures == 0, "%d failures", failures);
+        return EXIT_SUCCESS;
+    } catch (const std::exception& e) {
+        fprintf(stderr, "Exception: %s\n", e.what());
+    } catch (...) {
+        fprintf(stderr, "Unknown exception\n");
+    }
+    return EXIT_FAILURE;
+}